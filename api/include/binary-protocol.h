@@ -0,0 +1,301 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Binary variant of the FlaschenTaschen protocol. It is accepted on the same
+// port as the PPM variant; the server tells them apart by the magic bytes.
+// See doc/protocols.md for the description of the fields.
+
+#ifndef FT_BINARY_PROTOCOL_H
+#define FT_BINARY_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+static const uint8_t kBinaryProtocolVersion = 1;
+static const size_t kBinaryPacketHeaderSize = 24;
+
+// Bits in BinaryPacketHeader::flags.
+enum BinaryPacketFlags {
+    // The frame only contains the parts that changed since the previous
+    // frame of the same sender; everything else stays as it is.
+    BINARY_FLAG_DELTA = 0x01
+};
+
+// Encoding of the pixel data following the header.
+enum BinaryPixelFormat {
+    PIXEL_FORMAT_RGB = 0,      // r,g,b bytes per pixel, row by row.
+    PIXEL_FORMAT_RLE = 1,      // Run length encoded; see EncodeRLE().
+    PIXEL_FORMAT_PALETTE = 2   // Indexed colors; see EncodePalette().
+};
+
+struct BinaryPacketHeader {
+    uint8_t flags;          // BinaryPacketFlags
+    uint8_t format;         // BinaryPixelFormat
+    uint8_t layer;
+    uint16_t width;
+    uint16_t height;
+    int16_t offset_x;
+    int16_t offset_y;
+    uint32_t frame_id;      // Same for all tiles of one frame.
+    uint16_t tile_index;    // This is tile number tile_index ..
+    uint16_t tile_count;    // .. of tile_count tiles the frame consists of.
+};
+
+// Write header to "out", which needs to have space for
+// kBinaryPacketHeaderSize bytes. Returns number of bytes written.
+static inline size_t EncodeBinaryPacketHeader(const BinaryPacketHeader &h,
+                                              uint8_t *out) {
+    out[0] = 'F';
+    out[1] = 'T';
+    out[2] = 'B';
+    out[3] = kBinaryProtocolVersion;
+    out[4] = kBinaryPacketHeaderSize;
+    out[5] = h.flags;
+    out[6] = h.format;
+    out[7] = h.layer;
+    out[8] = h.width >> 8;          out[9] = h.width;
+    out[10] = h.height >> 8;        out[11] = h.height;
+    out[12] = (uint16_t)h.offset_x >> 8;  out[13] = h.offset_x;
+    out[14] = (uint16_t)h.offset_y >> 8;  out[15] = h.offset_y;
+    out[16] = h.frame_id >> 24;     out[17] = h.frame_id >> 16;
+    out[18] = h.frame_id >> 8;      out[19] = h.frame_id;
+    out[20] = h.tile_index >> 8;    out[21] = h.tile_index;
+    out[22] = h.tile_count >> 8;    out[23] = h.tile_count;
+    return kBinaryPacketHeaderSize;
+}
+
+// Decode the header of "packet". Returns
+//   * the size of the header, i.e. the offset of the pixel data, if this is
+//     a binary packet we understand.
+//   * 0 if this is not a binary packet (but e.g. PPM).
+//   * -1 if this is a binary packet, but broken or of an unknown version.
+static inline int DecodeBinaryPacketHeader(const uint8_t *packet, size_t size,
+                                           BinaryPacketHeader *h) {
+    if (size < 5 || packet[0] != 'F' || packet[1] != 'T' || packet[2] != 'B')
+        return 0;
+    // Compatible extensions append fields to the header, so we go by the
+    // header size to find the pixel data.
+    const size_t header_size = packet[4];
+    if (packet[3] != kBinaryProtocolVersion ||
+        header_size < kBinaryPacketHeaderSize || header_size > size)
+        return -1;
+    h->flags = packet[5];
+    h->format = packet[6];
+    h->layer = packet[7];
+    h->width = (packet[8] << 8) | packet[9];
+    h->height = (packet[10] << 8) | packet[11];
+    h->offset_x = (int16_t)((packet[12] << 8) | packet[13]);
+    h->offset_y = (int16_t)((packet[14] << 8) | packet[15]);
+    h->frame_id = ((uint32_t)packet[16] << 24) | (packet[17] << 16)
+        | (packet[18] << 8) | packet[19];
+    h->tile_index = (packet[20] << 8) | packet[21];
+    h->tile_count = (packet[22] << 8) | packet[23];
+    return header_size;
+}
+
+// -- Compressed pixel formats. Encoders return the number of bytes written to
+// "out", or 0 if the result would not fit into "max_size" bytes, in which
+// case sending it raw or in another format is better. Decoders write the
+// pixels to "rgb" as r,g,b triples and return the number of complete rows
+// they could decode from the data.
+
+// PIXEL_FORMAT_RLE: the pixels, row after row, as a sequence of chunks that
+// start with a control byte c:
+//   c < 128  : c + 1 literal pixels follow, three bytes each.
+//   c >= 128 : a single pixel follows that repeats c - 126 times (2..129).
+static inline size_t EncodeRLE(const uint8_t *rgb, int pixels,
+                               uint8_t *out, size_t max_size) {
+    size_t pos = 0;
+    int i = 0;
+    while (i < pixels) {
+        const uint8_t *const p = rgb + 3 * i;
+        int run = 1;
+        while (i + run < pixels && run < 129 && memcmp(p, p + 3*run, 3) == 0)
+            ++run;
+        if (run >= 2) {
+            if (pos + 4 > max_size) return 0;
+            out[pos++] = 126 + run;
+            memcpy(out + pos, p, 3);
+            pos += 3;
+            i += run;
+            continue;
+        }
+        // Literal up to where the next run starts.
+        int literal = 1;
+        while (i + literal < pixels && literal < 128 &&
+               !(i + literal + 1 < pixels &&
+                 memcmp(p + 3*literal, p + 3*(literal+1), 3) == 0)) {
+            ++literal;
+        }
+        if (pos + 1 + 3 * literal > max_size) return 0;
+        out[pos++] = literal - 1;
+        memcpy(out + pos, p, 3 * literal);
+        pos += 3 * literal;
+        i += literal;
+    }
+    return pos;
+}
+
+// Only the pixels within the columns [x0, x1) and rows [y0, y1) of the image
+// are written to "rgb", which has room for (x1 - x0) * (y1 - y0) pixels. The
+// rows returned are those of that window. The rest is decoded, but skipped.
+static inline int DecodeRLEWindow(const uint8_t *in, size_t size, int width,
+                                  int x0, int y0, int x1, int y1,
+                                  uint8_t *rgb) {
+    if (width <= 0 || x0 >= x1 || y0 >= y1) return 0;
+    const size_t total = (size_t)width * y1;
+    const size_t out_width = x1 - x0;
+    const uint8_t *const end = in + size;
+    size_t done = 0;
+    while (done < total && in < end) {
+        const int c = *in++;
+        size_t count = (c < 128) ? c + 1 : c - 126;
+        if (count > total - done) count = total - done;
+        const bool literal = (c < 128);
+        if (literal) {
+            if ((size_t)(end - in) < 3 * count)
+                count = (end - in) / 3;    // Truncated.
+        } else if (end - in < 3) {
+            break;
+        }
+        // Copy the chunk a row at a time, only what is in the window.
+        for (size_t left = count; left > 0; /**/) {
+            const int y = done / width;
+            const int x = done % width;
+            const size_t n = (left < (size_t)(width - x)) ? left : width - x;
+            const int from = (x > x0) ? x : x0;
+            const int to = (x + (int)n < x1) ? x + (int)n : x1;
+            if (y >= y0 && from < to) {
+                uint8_t *const out = rgb + 3 * ((y - y0) * out_width
+                                                + from - x0);
+                if (literal) {
+                    memcpy(out, in + 3 * (from - x), 3 * (to - from));
+                } else {
+                    for (int i = 0; i < to - from; ++i)
+                        memcpy(out + 3 * i, in, 3);
+                }
+            }
+            if (literal) in += 3 * n;
+            done += n;
+            left -= n;
+        }
+        if (!literal) in += 3;
+    }
+    const int rows = done / width - y0;
+    return rows > 0 ? rows : 0;
+}
+
+static inline int DecodeRLE(const uint8_t *in, size_t size,
+                            int width, int height, uint8_t *rgb) {
+    return DecodeRLEWindow(in, size, width, 0, 0, width, height, rgb);
+}
+
+// PIXEL_FORMAT_PALETTE: one byte with the number of palette entries minus
+// one, the palette entries with three bytes each, then for each row the
+// indices into the palette, packed into 1, 2, 4 or 8 bits, whatever is the
+// smallest to fit the palette size; most significant bits first. Each row
+// starts with a new byte.
+static inline int PaletteIndexBits(int palette_size) {
+    return palette_size <= 2 ? 1 : palette_size <= 4 ? 2
+        : palette_size <= 16 ? 4 : 8;
+}
+
+static inline size_t EncodePalette(const uint8_t *rgb, int width, int height,
+                                   uint8_t *out, size_t max_size) {
+    // Small hash table from color to palette index.
+    enum { kSlots = 512 };
+    uint32_t keys[kSlots];    // color + 1; 0 is an empty slot.
+    uint8_t index[kSlots];
+    memset(keys, 0, sizeof(keys));
+    const int pixels = width * height;
+    if (pixels <= 0) return 0;
+
+    // First pass: collect palette.
+    int palette_size = 0;
+    uint8_t *const palette = out + 1;
+    for (int i = 0; i < pixels; ++i) {
+        const uint8_t *const p = rgb + 3 * i;
+        const uint32_t key = ((p[0] << 16) | (p[1] << 8) | p[2]) + 1;
+        uint32_t slot = (key * 2654435761u) >> 23;
+        while (keys[slot] != 0 && keys[slot] != key)
+            slot = (slot + 1) % kSlots;
+        if (keys[slot] != 0)
+            continue;
+        if (palette_size == 256 || (size_t)(3 * palette_size + 4) > max_size)
+            return 0;
+        keys[slot] = key;
+        index[slot] = palette_size;
+        memcpy(palette + 3 * palette_size, p, 3);
+        palette_size++;
+    }
+    const int bits = PaletteIndexBits(palette_size);
+    const size_t row_bytes = (width * bits + 7) / 8;
+    const size_t total_size = 1 + 3 * palette_size + height * row_bytes;
+    if (total_size > max_size)
+        return 0;
+
+    // Second pass: indices.
+    out[0] = palette_size - 1;
+    uint8_t *row = palette + 3 * palette_size;
+    memset(row, 0, height * row_bytes);
+    for (int y = 0; y < height; ++y, row += row_bytes) {
+        for (int x = 0; x < width; ++x, rgb += 3) {
+            const uint32_t key = ((rgb[0] << 16) | (rgb[1] << 8) | rgb[2]) + 1;
+            uint32_t slot = (key * 2654435761u) >> 23;
+            while (keys[slot] != key)
+                slot = (slot + 1) % kSlots;
+            const int bit = x * bits;
+            row[bit / 8] |= index[slot] << (8 - bits - bit % 8);
+        }
+    }
+    return total_size;
+}
+
+// Like DecodeRLEWindow(), only the window [x0, x1) x [y0, y1) is written.
+static inline int DecodePaletteWindow(const uint8_t *in, size_t size,
+                                      int width, int x0, int y0, int x1, int y1,
+                                      uint8_t *rgb) {
+    if (size < 1 || width <= 0 || x0 >= x1 || y0 >= y1) return 0;
+    const int palette_size = in[0] + 1;
+    if (size < 1 + 3 * (size_t)palette_size) return 0;
+    uint8_t palette[3 * 256];   // Indices beyond the palette are black.
+    memset(palette, 0, sizeof(palette));
+    memcpy(palette, in + 1, 3 * palette_size);
+    in += 1 + 3 * palette_size;
+    size -= 1 + 3 * palette_size;
+
+    const int bits = PaletteIndexBits(palette_size);
+    const int mask = (1 << bits) - 1;
+    const size_t row_bytes = (width * bits + 7) / 8;
+    int rows = size / row_bytes;
+    if (rows > y1) rows = y1;
+    if (rows <= y0) return 0;
+    in += y0 * row_bytes;
+    for (int y = y0; y < rows; ++y, in += row_bytes) {
+        for (int x = x0; x < x1; ++x, rgb += 3) {
+            const int bit = x * bits;
+            const int i = (in[bit / 8] >> (8 - bits - bit % 8)) & mask;
+            memcpy(rgb, palette + 3 * i, 3);
+        }
+    }
+    return rows - y0;
+}
+
+static inline int DecodePalette(const uint8_t *in, size_t size,
+                                int width, int height, uint8_t *rgb) {
+    return DecodePaletteWindow(in, size, width, 0, 0, width, height, rgb);
+}
+
+#endif  // FT_BINARY_PROTOCOL_H
@@ -16,6 +16,7 @@
 #ifndef FLASCHEN_TASCHEN_H_
 #define FLASCHEN_TASCHEN_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 struct Color {
@@ -40,6 +41,34 @@ public:
 
     virtual void SetPixel(int x, int y, const Color &col) = 0;
     virtual void Send() = 0;
+
+    // Copy a "w" x "h" rectangle of pixels to position (x, y). The source
+    // "rgb" contains r,g,b byte triples, rows are "stride" bytes apart.
+    // Parts outside the canvas are clipped.
+    // The default implementation uses SetPixel(); implementations override
+    // this with a faster bulk copy.
+    virtual void Blit(int x, int y, int w, int h,
+                      const uint8_t *rgb, size_t stride) {
+        if (!ClipToCanvas(&x, &y, &w, &h, &rgb, stride)) return;
+        for (int row = 0; row < h; ++row, rgb += stride) {
+            const uint8_t *pixel = rgb;
+            for (int col = 0; col < w; ++col, pixel += 3) {
+                SetPixel(x + col, y + row, Color(pixel[0], pixel[1], pixel[2]));
+            }
+        }
+    }
+
+protected:
+    // Clip rectangle for Blit() to the canvas and advance "rgb" to the
+    // first visible pixel. Returns false if nothing is visible.
+    bool ClipToCanvas(int *x, int *y, int *w, int *h,
+                      const uint8_t **rgb, size_t stride) const {
+        if (*x < 0) { *w += *x; *rgb += 3 * -*x; *x = 0; }
+        if (*y < 0) { *h += *y; *rgb += stride * -*y; *y = 0; }
+        if (*x + *w > width()) *w = width() - *x;
+        if (*y + *h > height()) *h = height() - *y;
+        return *w > 0 && *h > 0;
+    }
 };
 
 #endif // FLASCHEN_TASCHEN_H_
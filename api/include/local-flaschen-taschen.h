@@ -0,0 +1,99 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef LOCAL_FLASCHEN_TASCHEN_H
+#define LOCAL_FLASCHEN_TASCHEN_H
+
+#include "flaschen-taschen.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Connect to the local socket of a FlaschenTaschen server running on the
+// same machine (server option --local-socket).
+// If "path" is NULL, attempts to get it from environment-variable
+// FT_LOCAL_SOCKET.
+// If that is not set, uses the default /tmp/flaschen-taschen.sock
+// Returns the socket or -1 if the server can't be reached.
+int OpenLocalFlaschenTaschenSocket(const char *path);
+
+// Set the brightness of the whole display in percent (0..100), using a
+// socket freshly returned by OpenLocalFlaschenTaschenSocket(); it can't be
+// used for anything else afterwards. Returns true once the server has
+// applied it.
+bool SetLocalFlaschenTaschenBrightness(int socket, int percent);
+
+// A Framebuffer display interface for producers running on the same machine
+// as the server. Pixels are drawn right into memory shared with the server,
+// so a Send() costs a short notification instead of copying the frame
+// through the network stack.
+//
+// Linux only, as it needs memfd_create().
+class LocalFlaschenTaschen : public FlaschenTaschen {
+public:
+    // Create a canvas that is sent to the server connected to with
+    // OpenLocalFlaschenTaschenSocket(). The shared memory holds "slots"
+    // frames: this many Send()s can be in flight before Send() waits for
+    // the server to catch up.
+    LocalFlaschenTaschen(int socket, int width, int height, int slots = 3);
+    ~LocalFlaschenTaschen();
+
+    // If setting up the shared memory with the server failed, this is
+    // still a canvas, but Send() does nothing.
+    bool is_connected() const { return shared_memory_ != NULL; }
+
+    // -- FlaschenTaschen interface implementation
+    virtual int width() const { return width_; }
+    virtual int height() const { return height_; }
+
+    virtual void SetPixel(int x, int y, const Color &col);
+    virtual void Blit(int x, int y, int w, int h,
+                      const uint8_t *rgb, size_t stride);
+    virtual void Send();
+
+    // -- Additional features.
+    void Clear();               // Clear screen (fill with black).
+    void Fill(const Color &c);  // Fill screen with color.
+
+    // Set offset where this picture should be displayed on the remote
+    // display. See UDPFlaschenTaschen::SetOffset().
+    void SetOffset(int offset_x, int offset_y, int offset_z = 0);
+
+    // Get pixel color at given position. Coordinates outside the range
+    // are wrapped around.
+    const Color &GetPixel(int x, int y) const;
+
+private:
+    LocalFlaschenTaschen(const LocalFlaschenTaschen&);  // Not copyable.
+
+    bool SetupSharedMemory();
+    Color *Slot(int slot) const;
+
+    const int fd_;
+    const int width_;
+    const int height_;
+    const int slot_count_;
+
+    uint8_t *shared_memory_;     // NULL if not connected.
+    size_t shared_memory_size_;
+    int current_slot_;           // The slot we draw into.
+    int in_flight_;              // Slots sent, but not returned yet.
+    Color *pixel_buffer_;        // Current slot, or own memory if not connected.
+
+    int off_x_;
+    int off_y_;
+    int off_z_;
+};
+
+#endif  // LOCAL_FLASCHEN_TASCHEN_H
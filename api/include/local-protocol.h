@@ -0,0 +1,70 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Local transport for producers running on the same machine as the server.
+// Frames are not sent through the network stack, but are written into
+// shared memory; only short notifications go through a Unix domain socket.
+//
+//  * The client creates a sealed memfd holding a ring of "slot_count"
+//    frame slots of width * height r,g,b pixels each, and connects to the
+//    server's SOCK_SEQPACKET socket. The first message is a LocalHello,
+//    with the memfd attached as SCM_RIGHTS.
+//  * For each frame, the client fills the next slot and sends a
+//    LocalFrameMessage. Once the server has copied the slot to the display,
+//    it sends the slot number back; only then the client uses that slot
+//    again. Slots are used and returned in order.
+//
+// Instead of a LocalHello, the first message can also be a LocalBrightness,
+// which changes the brightness of the whole display (server options --gamma
+// etc.). The server sends the same message back once it is applied.
+//
+// See doc/protocols.md.
+
+#ifndef FT_LOCAL_PROTOCOL_H
+#define FT_LOCAL_PROTOCOL_H
+
+#include <stdint.h>
+
+#define DEFAULT_FT_LOCAL_SOCKET "/tmp/flaschen-taschen.sock"
+
+static const uint32_t kLocalProtocolMagic = 0x46544c31;  // "FTL1"
+static const uint32_t kLocalBrightnessMagic = 0x4654424c;  // "FTBL"
+static const int kLocalMaxSlots = 16;
+
+struct LocalHello {
+    uint32_t magic;         // kLocalProtocolMagic
+    uint16_t width;
+    uint16_t height;
+    uint16_t slot_count;    // 1 .. kLocalMaxSlots
+};
+
+struct LocalBrightness {
+    uint32_t magic;         // kLocalBrightnessMagic
+    uint8_t percent;        // 0 .. 100
+};
+
+struct LocalFrameMessage {
+    uint16_t slot;
+    int16_t offset_x;
+    int16_t offset_y;
+    uint8_t layer;
+};
+
+// Bytes of the shared memory needed for the given canvas.
+static inline size_t LocalSharedMemorySize(int width, int height,
+                                           int slot_count) {
+    return (size_t)slot_count * width * height * 3;
+}
+
+#endif  // FT_LOCAL_PROTOCOL_H
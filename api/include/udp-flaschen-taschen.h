@@ -31,6 +31,11 @@ int OpenFlaschenTaschenSocket(const char *host);
 // simple.
 class UDPFlaschenTaschen : public FlaschenTaschen {
 public:
+    enum Protocol {
+        PROTOCOL_PPM,     // PPM with #FT: header comment. Any server.
+        PROTOCOL_BINARY   // Compact binary header; needs a recent server.
+    };
+
     // Create a canvas that can be sent to a FlaschenTaschen server.
     // Socket can be -1, but then you have to use the explicit Send(int fd).
     //
@@ -39,7 +44,7 @@ public:
     // in OSX, which has a limit of about 9000.
     //
     // The UDP size can be overwritten with the FT_UDP_SIZE environment
-    // variable.
+    // variable, the protocol (see SetProtocol()) with FT_PROTOCOL.
     UDPFlaschenTaschen(int socket, int width, int height,
                        size_t max_udp_size = 65507);
     UDPFlaschenTaschen(const UDPFlaschenTaschen& other);
@@ -50,6 +55,8 @@ public:
     virtual int height() const { return height_; }
 
     virtual void SetPixel(int x, int y, const Color &col);
+    virtual void Blit(int x, int y, int w, int h,
+                      const uint8_t *rgb, size_t stride);
 
     // Send to file-descriptor given in constructor.
     virtual void Send() { Send(fd_); }
@@ -66,6 +73,25 @@ public:
     // Returns boolean if setting the value was successful.
     bool SetMaxUDPPacketSize(size_t packet_size);
 
+    // Choose the protocol to send with. Default is PROTOCOL_PPM, unless the
+    // environment variable FT_PROTOCOL is set to "binary".
+    // The binary protocol has less overhead and carries a frame number, so
+    // that servers can tell which tiles of a larger image belong together.
+    // It also compresses images (run length encoding or a color palette)
+    // whenever that makes them smaller.
+    void SetProtocol(Protocol protocol) { protocol_ = protocol; }
+
+    // With the binary protocol, Send() only transmits the rows that changed
+    // since the previous Send(); if nothing changed, a single pixel, so that
+    // the server still knows the layer is in use. Every "interval" frames,
+    // the whole image is sent again, so that the display recovers from lost
+    // packets. An interval of 1 sends every frame in full. Default is 30.
+    //
+    // The whole image is also sent if something else was sent through the
+    // same socket in between, e.g. by a Clone() of this canvas, as the
+    // server doesn't have this canvas' previous frame then.
+    void SetKeyframeInterval(int interval) { keyframe_interval_ = interval; }
+
     void Send(int fd) const;    // Send to given file-descriptor.
     void Clear();               // Clear screen (fill with black).
     void Fill(const Color &c);  // Fill screen with color.
@@ -84,6 +110,9 @@ public:
     const Color &GetPixel(int x, int y) const;
 
 private:
+    void SendPPM(int fd) const;
+    void SendBinary(int fd) const;
+
     const int fd_;
     const int width_;
     const int height_;
@@ -94,6 +123,19 @@ private:
     int off_z_;
 
     size_t max_udp_size_;
+    Protocol protocol_;
+    const uint32_t id_;          // Tells canvases sending on a socket apart.
+
+    // Scratch space for compressing in the binary protocol.
+    mutable uint8_t *encode_buffer_;
+    mutable size_t encode_buffer_size_;
+
+    // Frame sent last and where to, to find out what changed.
+    int keyframe_interval_;
+    mutable Color *last_sent_;   // NULL until the first frame is sent.
+    mutable int last_fd_;
+    mutable int last_off_x_, last_off_y_, last_off_z_;
+    mutable int frames_since_keyframe_;
 };
 
 #endif  // UDP_FLASCHEN_TASCHEN_H
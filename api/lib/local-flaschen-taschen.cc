@@ -0,0 +1,233 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "local-flaschen-taschen.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "local-protocol.h"
+
+int OpenLocalFlaschenTaschenSocket(const char *path) {
+    if (path == NULL) {
+        path = getenv("FT_LOCAL_SOCKET");  // Take from environment.
+    }
+    if (path == NULL || strlen(path) == 0) {
+        path = DEFAULT_FT_LOCAL_SOCKET;    // Fallback.
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        perror(path);
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+bool SetLocalFlaschenTaschenBrightness(int socket, int percent) {
+    if (socket < 0 || percent < 0 || percent > 100)
+        return false;
+    LocalBrightness request;
+    memset(&request, 0, sizeof(request));
+    request.magic = kLocalBrightnessMagic;
+    request.percent = percent;
+    if (send(socket, &request, sizeof(request), MSG_NOSIGNAL) < 0)
+        return false;
+    LocalBrightness reply;
+    return recv(socket, &reply, sizeof(reply), 0) == (ssize_t)sizeof(reply)
+        && reply.magic == kLocalBrightnessMagic;
+}
+
+LocalFlaschenTaschen::LocalFlaschenTaschen(int socket, int width, int height,
+                                           int slots)
+    : fd_(socket), width_(width), height_(height),
+      slot_count_(std::max(1, std::min(slots, kLocalMaxSlots))),
+      shared_memory_(NULL), shared_memory_size_(0),
+      current_slot_(0), in_flight_(0), pixel_buffer_(NULL) {
+    if (fd_ >= 0 && !SetupSharedMemory()) {
+        perror("Setting up shared memory with FlaschenTaschen server");
+    }
+    pixel_buffer_ = is_connected() ? Slot(0) : new Color [ width_ * height_ ];
+    SetOffset(0, 0, 0);
+    Clear();
+}
+
+LocalFlaschenTaschen::~LocalFlaschenTaschen() {
+    if (shared_memory_) {
+        munmap(shared_memory_, shared_memory_size_);
+    } else {
+        delete [] pixel_buffer_;
+    }
+}
+
+// Create the shared memory, map it and hand it to the server. Sealed, so
+// that we can't shrink it under the server's feet.
+bool LocalFlaschenTaschen::SetupSharedMemory() {
+    if (width_ <= 0 || height_ <= 0 || width_ > 65535 || height_ > 65535) {
+        errno = EINVAL;
+        return false;
+    }
+#ifdef __linux__
+    const size_t size = LocalSharedMemorySize(width_, height_, slot_count_);
+    int mem_fd = memfd_create("flaschen-taschen",
+                              MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (mem_fd < 0)
+        return false;
+    if (ftruncate(mem_fd, size) < 0
+        || fcntl(mem_fd, F_ADD_SEALS,
+                 F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        close(mem_fd);
+        return false;
+    }
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     mem_fd, 0);
+    if (mem == MAP_FAILED) {
+        close(mem_fd);
+        return false;
+    }
+
+    LocalHello hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.magic = kLocalProtocolMagic;
+    hello.width = width_;
+    hello.height = height_;
+    hello.slot_count = slot_count_;
+    struct iovec iov;
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &mem_fd, sizeof(int));
+    const bool success = (sendmsg(fd_, &msg, MSG_NOSIGNAL) >= 0);
+    close(mem_fd);   // The mapping and the server keep it alive.
+    if (!success) {
+        munmap(mem, size);
+        return false;
+    }
+    shared_memory_ = (uint8_t*) mem;
+    shared_memory_size_ = size;
+    return true;
+#else
+    errno = ENOSYS;
+    return false;
+#endif
+}
+
+Color *LocalFlaschenTaschen::Slot(int slot) const {
+    return (Color*) (shared_memory_ + (size_t)slot * width_ * height_ * 3);
+}
+
+void LocalFlaschenTaschen::Clear() {
+    bzero(pixel_buffer_, width_ * height_ * sizeof(Color));
+}
+
+void LocalFlaschenTaschen::Fill(const Color &c) {
+    if (c.is_black()) {
+        Clear();  // cheaper
+    } else {
+        std::fill(pixel_buffer_, pixel_buffer_ + width_*height_, c);
+    }
+}
+
+void LocalFlaschenTaschen::SetOffset(int off_x, int off_y, int off_z){
+    off_x_ = off_x;
+    off_y_ = off_y;
+    off_z_ = off_z;
+}
+
+void LocalFlaschenTaschen::SetPixel(int x, int y, const Color &col) {
+    if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
+    pixel_buffer_[x + y * width_] = col;
+}
+
+void LocalFlaschenTaschen::Blit(int x, int y, int w, int h,
+                                const uint8_t *rgb, size_t stride) {
+    if (!ClipToCanvas(&x, &y, &w, &h, &rgb, stride)) return;
+    for (int row = 0; row < h; ++row, rgb += stride) {
+        memcpy(pixel_buffer_ + x + (y + row) * width_, rgb, 3 * w);
+    }
+}
+
+const Color &LocalFlaschenTaschen::GetPixel(int x, int y) const {
+    return pixel_buffer_[(x % width_) + (y % height_) * width_];
+}
+
+void LocalFlaschenTaschen::Send() {
+    if (!is_connected())
+        return;
+    LocalFrameMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.slot = current_slot_;
+    msg.offset_x = off_x_;
+    msg.offset_y = off_y_;
+    msg.layer = off_z_;
+    if (send(fd_, &msg, sizeof(msg), MSG_NOSIGNAL) < 0) {
+        perror("Error sending frame.");
+        return;
+    }
+    ++in_flight_;
+
+    // Slots come back in the order they were sent, so once all are in
+    // flight, the next one is free as soon as the server returns one.
+    const int next_slot = (current_slot_ + 1) % slot_count_;
+    if (in_flight_ == slot_count_) {
+        uint16_t returned;
+        if (recv(fd_, &returned, sizeof(returned), 0) <= 0) {
+            // Server went away; nobody reads the slots anymore.
+            in_flight_ = 0;
+        } else {
+            --in_flight_;
+        }
+    }
+
+    // The canvas keeps its content after Send(), like the other
+    // implementations.
+    if (next_slot != current_slot_) {
+        memcpy(Slot(next_slot), pixel_buffer_, width_ * height_ * 3);
+        current_slot_ = next_slot;
+        pixel_buffer_ = Slot(next_slot);
+    }
+}
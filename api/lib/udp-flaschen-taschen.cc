@@ -34,11 +34,32 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <vector>
+
+#include "binary-protocol.h"
 
 #define DEFAULT_FT_DISPLAY_HOST "ft.noise"
 
 static const int kFlaschenTaschenHeaderReserve = 64;  // PPM header
 
+// For the binary protocol. Frame ids are taken from one sequence for all
+// canvases, so that frames sent through the same socket never have the same
+// id. For each socket, we remember the canvas that sent through it last: a
+// delta frame only makes sense to the server if it was the same.
+static uint32_t next_frame_id = 0;
+static uint32_t next_canvas_id = 1;
+static const int kMaxTrackedSocket = 1024;
+static uint32_t last_canvas_on_socket[kMaxTrackedSocket];
+
+// Note "canvas_id" as sender on "fd". Returns true if it was the previous
+// sender as well.
+static bool SwapLastSender(int fd, uint32_t canvas_id) {
+    if (fd < 0 || fd >= kMaxTrackedSocket)
+        return false;
+    return __atomic_exchange_n(&last_canvas_on_socket[fd], canvas_id,
+                               __ATOMIC_RELAXED) == canvas_id;
+}
+
 int OpenFlaschenTaschenSocket(const char *host) {
     if (host == NULL) {
         host = getenv("FT_DISPLAY");     // Take from environment.
@@ -88,13 +109,20 @@ UDPFlaschenTaschen::UDPFlaschenTaschen(int socket, int width, int height,
                                        size_t max_udp_size)
     : fd_(socket), width_(width), height_(height),
       pixel_buffer_(new Color [ width_ * height ]),
-      max_udp_size_(65507) {
+      max_udp_size_(65507), protocol_(PROTOCOL_PPM),
+      id_(__atomic_fetch_add(&next_canvas_id, 1, __ATOMIC_RELAXED)),
+      encode_buffer_(NULL), encode_buffer_size_(0),
+      keyframe_interval_(30), last_sent_(NULL), frames_since_keyframe_(0) {
     SetMaxUDPPacketSize(max_udp_size);
 
     // Allow override with environment variable.
     if (getenv("FT_UDP_SIZE")) {
         SetMaxUDPPacketSize(atoi(getenv("FT_UDP_SIZE")));
     }
+    const char *protocol = getenv("FT_PROTOCOL");
+    if (protocol && strcasecmp(protocol, "binary") == 0) {
+        SetProtocol(PROTOCOL_BINARY);
+    }
 
     SetOffset(0, 0, 0);
     Clear();
@@ -103,12 +131,20 @@ UDPFlaschenTaschen::UDPFlaschenTaschen(int socket, int width, int height,
 UDPFlaschenTaschen::UDPFlaschenTaschen(const UDPFlaschenTaschen& other)
     : fd_(other.fd_), width_(other.width_), height_(other.height_),
       pixel_buffer_(new Color [ width_ * height_ ]),
-      max_udp_size_(other.max_udp_size_) {
+      max_udp_size_(other.max_udp_size_), protocol_(other.protocol_),
+      id_(__atomic_fetch_add(&next_canvas_id, 1, __ATOMIC_RELAXED)),
+      encode_buffer_(NULL), encode_buffer_size_(0),
+      keyframe_interval_(other.keyframe_interval_), last_sent_(NULL),
+      frames_since_keyframe_(0) {
     SetOffset(other.off_x_, other.off_y_, other.off_z_);
     memcpy(pixel_buffer_, other.pixel_buffer_, width_ * height_ * 3);
 }
 
-UDPFlaschenTaschen::~UDPFlaschenTaschen() { delete [] pixel_buffer_; }
+UDPFlaschenTaschen::~UDPFlaschenTaschen() {
+    delete [] last_sent_;
+    delete [] encode_buffer_;
+    delete [] pixel_buffer_;
+}
 
 bool UDPFlaschenTaschen::SetMaxUDPPacketSize(size_t packet_size) {
     if (packet_size > 65507) {
@@ -151,11 +187,27 @@ void UDPFlaschenTaschen::SetPixel(int x, int y, const Color &col) {
     pixel_buffer_[x + y * width_] = col;
 }
 
+void UDPFlaschenTaschen::Blit(int x, int y, int w, int h,
+                              const uint8_t *rgb, size_t stride) {
+    if (!ClipToCanvas(&x, &y, &w, &h, &rgb, stride)) return;
+    for (int row = 0; row < h; ++row, rgb += stride) {
+        memcpy(pixel_buffer_ + x + (y + row) * width_, rgb, 3 * w);
+    }
+}
+
 const Color &UDPFlaschenTaschen::GetPixel(int x, int y) const {
     return pixel_buffer_[(x % width_) + (y % height_) * width_];
 }
 
 void UDPFlaschenTaschen::Send(int fd) const {
+    if (protocol_ == PROTOCOL_BINARY) {
+        SendBinary(fd);
+    } else {
+        SendPPM(fd);
+    }
+}
+
+void UDPFlaschenTaschen::SendPPM(int fd) const {
     const int kMaxDataLen = max_udp_size_ - kFlaschenTaschenHeaderReserve;
     const size_t row_size = 3 * width_;
     const int max_send_height = kMaxDataLen / row_size;
@@ -188,6 +240,153 @@ void UDPFlaschenTaschen::Send(int fd) const {
     }
 }
 
+namespace {
+struct Rect {
+    Rect(int xx, int yy, int ww, int hh) : x(xx), y(yy), w(ww), h(hh) {}
+    int x, y, w, h;
+};
+}
+
+// Find the parts of the image that differ between "before" and "now". Each
+// run of changed rows becomes one rectangle, as wide as the changes in it.
+// Runs only separated by a few unchanged rows are combined; an extra packet
+// costs more than these rows.
+static void FindChangedRects(const Color *before, const Color *now,
+                             int width, int height, std::vector<Rect> *rects) {
+    const int kMaxGap = 2;
+    int gap = 0;
+    for (int y = 0; y < height; ++y) {
+        const Color *const a = before + y * width;
+        const Color *const b = now + y * width;
+        if (memcmp(a, b, 3 * width) == 0) {
+            ++gap;
+            continue;
+        }
+        int first = 0, last = width - 1;
+        while (memcmp(&a[first], &b[first], 3) == 0) ++first;
+        while (memcmp(&a[last], &b[last], 3) == 0) --last;
+
+        if (!rects->empty() && gap <= kMaxGap) {
+            Rect &r = rects->back();    // Extend to this row.
+            const int right = std::max(r.x + r.w, last + 1);
+            r.x = std::min(r.x, first);
+            r.w = right - r.x;
+            r.h = y + 1 - r.y;
+        } else {
+            rects->push_back(Rect(first, y, last + 1 - first, 1));
+        }
+        gap = 0;
+    }
+}
+
+void UDPFlaschenTaschen::SendBinary(int fd) const {
+    const int kMaxDataLen = max_udp_size_ - kFlaschenTaschenHeaderReserve;
+    assert(kMaxDataLen >= 3 * width_);  // UDP needs to fit at least 1 row
+
+    // Scratch space: rows of a rectangle, and the two encodings of them.
+    if (encode_buffer_size_ < (size_t)kMaxDataLen) {
+        delete [] encode_buffer_;
+        encode_buffer_size_ = kMaxDataLen;
+        encode_buffer_ = new uint8_t[3 * encode_buffer_size_];
+    }
+    uint8_t *const gather = encode_buffer_;
+    uint8_t *const rle = encode_buffer_ + encode_buffer_size_;
+    uint8_t *const palette = encode_buffer_ + 2 * encode_buffer_size_;
+
+    const bool same_sender = SwapLastSender(fd, id_);
+    const bool keyframe = (last_sent_ == NULL || !same_sender || fd != last_fd_
+                           || frames_since_keyframe_ + 1 >= keyframe_interval_
+                           || off_x_ != last_off_x_ || off_y_ != last_off_y_
+                           || off_z_ != last_off_z_);
+    std::vector<Rect> rects;
+    if (keyframe) {
+        rects.push_back(Rect(0, 0, width_, height_));
+        frames_since_keyframe_ = 0;
+    } else {
+        FindChangedRects(last_sent_, pixel_buffer_, width_, height_, &rects);
+        if (rects.empty()) {
+            // Nothing changed, but the server needs to hear from us, or it
+            // takes our layer as abandoned and clears it.
+            rects.push_back(Rect(0, 0, 1, 1));
+        }
+        frames_since_keyframe_++;
+    }
+
+    BinaryPacketHeader header;
+    header.flags = keyframe ? 0 : BINARY_FLAG_DELTA;
+    header.layer = off_z_;
+    header.frame_id = __atomic_fetch_add(&next_frame_id, 1, __ATOMIC_RELAXED);
+    header.tile_index = 0;
+    header.tile_count = 0;
+    for (size_t i = 0; i < rects.size(); ++i) {
+        const int max_rows = kMaxDataLen / (3 * rects[i].w);
+        header.tile_count += (rects[i].h + max_rows - 1) / max_rows;
+    }
+
+    uint8_t header_buffer[kBinaryPacketHeaderSize];
+    for (size_t i = 0; i < rects.size(); ++i) {
+        const Rect &r = rects[i];
+        const size_t row_size = 3 * r.w;
+        const int max_rows = kMaxDataLen / row_size;
+        for (int y = 0; y < r.h; y += max_rows) {
+            const int send_h = std::min(max_rows, r.h - y);
+            const uint8_t *pixels;
+            if (r.w == width_) {
+                pixels = (const uint8_t*) &pixel_buffer_[(r.y + y) * width_];
+            } else {
+                for (int row = 0; row < send_h; ++row) {
+                    memcpy(gather + row * row_size,
+                           &pixel_buffer_[(r.y + y + row) * width_ + r.x],
+                           row_size);
+                }
+                pixels = gather;
+            }
+
+            // Use whatever encoding results in the smallest packet.
+            const uint8_t *payload = pixels;
+            size_t payload_len = send_h * row_size;
+            header.format = PIXEL_FORMAT_RGB;
+            size_t size = EncodeRLE(pixels, r.w * send_h, rle, payload_len - 1);
+            if (size > 0) {
+                header.format = PIXEL_FORMAT_RLE;
+                payload = rle;
+                payload_len = size;
+            }
+            size = EncodePalette(pixels, r.w, send_h, palette, payload_len - 1);
+            if (size > 0) {
+                header.format = PIXEL_FORMAT_PALETTE;
+                payload = palette;
+                payload_len = size;
+            }
+
+            header.width = r.w;
+            header.height = send_h;
+            header.offset_x = off_x_ + r.x;
+            header.offset_y = off_y_ + r.y + y;
+            const size_t header_len = EncodeBinaryPacketHeader(header,
+                                                               header_buffer);
+            struct iovec iov[2];
+            iov[0].iov_base = header_buffer;
+            iov[0].iov_len = header_len;
+            iov[1].iov_base = (void*)payload;
+            iov[1].iov_len = payload_len;
+            if (writev(fd, iov, 2) < 0) {
+                perror("Error sending packet.");
+            }
+            header.tile_index++;
+        }
+    }
+
+    if (last_sent_ == NULL) {
+        last_sent_ = new Color[width_ * height_];
+    }
+    memcpy(last_sent_, pixel_buffer_, width_ * height_ * 3);
+    last_fd_ = fd;
+    last_off_x_ = off_x_;
+    last_off_y_ = off_y_;
+    last_off_z_ = off_z_;
+}
+
 UDPFlaschenTaschen* UDPFlaschenTaschen::Clone() const {
     return new UDPFlaschenTaschen(*this);
 }
@@ -0,0 +1,212 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Synthetic load for a FlaschenTaschen server: a number of clients, each
+// in its own thread with its own socket, sending full frames, tiles or
+// sprites at a given rate.
+//
+// Each image contains a latency probe (see server/latency-probe.h) in its
+// top left corner, so that a server with the null display and
+// --latency-probes can report the time from sending to display.
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "latency-probe.h"
+#include "udp-flaschen-taschen.h"
+
+enum Mode { MODE_FULL, MODE_TILE, MODE_SPRITE };
+
+struct Client {
+    // Configuration
+    int index;
+    const char *host;
+    Mode mode;
+    int display_width, display_height;
+    int width, height;     // Size of the image sent.
+    int rate;              // Frames per second; 0: as fast as possible.
+    int64_t end_time_usec;
+
+    // Result
+    int64_t frames;
+    int64_t packets;
+};
+
+static int64_t MonotonicMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Number of packets UDPFlaschenTaschen::Send() splits an image into.
+static int PacketsPerImage(int width, int height) {
+    size_t max_udp_size = 65507;
+    if (getenv("FT_UDP_SIZE")) max_udp_size = atoi(getenv("FT_UDP_SIZE"));
+    const int rows_per_packet = (max_udp_size - 64) / (3 * width);
+    return (height + rows_per_packet - 1) / rows_per_packet;
+}
+
+static void *RunClient(void *arg) {
+    Client *const c = (Client*) arg;
+    const int fd = OpenFlaschenTaschenSocket(c->host);
+    if (fd < 0) return NULL;
+    UDPFlaschenTaschen canvas(fd, c->width, c->height);
+    const int packets_per_image = PacketsPerImage(c->width, c->height);
+
+    // Tiles don't overlap as long as there are enough of them.
+    const int tiles_x = std::max(1, c->display_width / c->width);
+    const int tiles_y = std::max(1, c->display_height / c->height);
+    const int tile_x = (c->index % tiles_x) * c->width;
+    const int tile_y = (c->index / tiles_x % tiles_y) * c->height;
+    const int sprite_range_x = std::max(1, c->display_width - c->width);
+    const int sprite_range_y = std::max(1, c->display_height - c->height);
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (MonotonicMicros() < c->end_time_usec) {
+        const int f = (int)c->frames;
+        // Never black, so that it also works in layers.
+        canvas.Fill(Color(1 + (f * 7 + c->index * 50) % 255,
+                          (f * 3) % 256, (c->index * 80) % 256));
+        switch (c->mode) {
+        case MODE_FULL:
+            canvas.SetOffset(0, 0, 0);
+            break;
+        case MODE_TILE:
+            canvas.SetOffset(tile_x, tile_y, 0);
+            break;
+        case MODE_SPRITE:
+            canvas.SetOffset((f + 5 * c->index) % sprite_range_x,
+                             (f + 3 * c->index) % sprite_range_y,
+                             1 + c->index % 15);
+            break;
+        }
+
+        uint8_t probe[kLatencyProbeBytes];
+        WriteLatencyProbe(LatencyProbeNow(), probe);
+        for (int i = 0; i < kLatencyProbeBytes / 3; ++i) {
+            canvas.SetPixel(i, 0, Color(probe[3*i], probe[3*i+1], probe[3*i+2]));
+        }
+        canvas.Send();
+        c->frames++;
+        c->packets += packets_per_image;
+
+        if (c->rate > 0) {
+            next.tv_nsec += 1000000000 / c->rate;
+            while (next.tv_nsec >= 1000000000) {
+                next.tv_nsec -= 1000000000;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+static int usage(const char *progname) {
+    fprintf(stderr, "usage: %s [options]\n", progname);
+    fprintf(stderr, "Options:\n"
+            "\t-h <host>      : Server to send to. Default: $FT_DISPLAY\n"
+            "\t-D <w>x<h>     : Size of the server display. Default 45x35\n"
+            "\t-c <clients>   : Number of clients, each in its own thread. Default 1\n"
+            "\t-r <fps>       : Frames per second per client; 0 is as fast\n"
+            "\t                 as possible. Default 30\n"
+            "\t-t <seconds>   : Duration. Default 5\n"
+            "\t-m <mode>      : What each client sends; one of\n"
+            "\t                 full   : full frames on the background (default)\n"
+            "\t                 tile   : a tile of the background each\n"
+            "\t                 sprite : moving sprites in layers 1..15\n"
+            "\t-s <w>x<h>     : Size of tiles or sprites. Default 9x7\n");
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *host = NULL;
+    int display_width = 45, display_height = 35;
+    int part_width = 9, part_height = 7;
+    int clients = 1;
+    int rate = 30;
+    int duration = 5;
+    Mode mode = MODE_FULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:D:c:r:t:m:s:")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'D':
+            if (sscanf(optarg, "%dx%d", &display_width, &display_height) != 2)
+                return usage(argv[0]);
+            break;
+        case 'c': clients = atoi(optarg); break;
+        case 'r': rate = atoi(optarg); break;
+        case 't': duration = atoi(optarg); break;
+        case 'm':
+            if (strcmp(optarg, "full") == 0) mode = MODE_FULL;
+            else if (strcmp(optarg, "tile") == 0) mode = MODE_TILE;
+            else if (strcmp(optarg, "sprite") == 0) mode = MODE_SPRITE;
+            else return usage(argv[0]);
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &part_width, &part_height) != 2)
+                return usage(argv[0]);
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (clients < 1 || rate < 0 || duration < 1 ||
+        display_width < 1 || display_height < 1 ||
+        part_width < 3 || part_height < 1) {  // Need room for the probe.
+        return usage(argv[0]);
+    }
+
+    const int64_t end_time = MonotonicMicros() + duration * 1000000LL;
+    std::vector<Client> client(clients);
+    std::vector<pthread_t> threads(clients);
+    for (int i = 0; i < clients; ++i) {
+        Client &c = client[i];
+        c.index = i;
+        c.host = host;
+        c.mode = mode;
+        c.display_width = display_width;
+        c.display_height = display_height;
+        c.width = (mode == MODE_FULL) ? display_width : part_width;
+        c.height = (mode == MODE_FULL) ? display_height : part_height;
+        c.rate = rate;
+        c.end_time_usec = end_time;
+        c.frames = c.packets = 0;
+        pthread_create(&threads[i], NULL, &RunClient, &c);
+    }
+
+    int64_t frames = 0, packets = 0;
+    for (int i = 0; i < clients; ++i) {
+        pthread_join(threads[i], NULL);
+        frames += client[i].frames;
+        packets += client[i].packets;
+    }
+    fprintf(stderr, "ft-loadgen: %d clients sent %lld frames in %lld packets "
+            "in %ds (%.1f frames/s, %.1f packets/s)\n",
+            clients, (long long)frames, (long long)packets, duration,
+            (double)frames / duration, (double)packets / duration);
+    return 0;
+}
@@ -0,0 +1,94 @@
+#!/usr/bin/env bash
+# Runs ft-loadgen against an ft-server with the null display on this machine
+# and reports throughput, dropped packets and latency from send to display.
+#
+# Options not listed below are passed on to ft-server.
+set -e
+
+usage() {
+    cat >&2 <<USAGE
+usage: $0 [options] [-- <ft-server options>]
+Options:
+  -c <clients>   : Number of sending clients. Default 4
+  -r <fps>       : Frames per second per client, 0 for max. Default 60
+  -t <seconds>   : Duration. Default 5
+  -m <mode>      : full, tile or sprite (see ft-loadgen). Default full
+  -s <w>x<h>     : Size of tiles or sprites. Default 9x7
+  -D <w>x<h>     : Display size. Default 45x35
+  -T <threads>   : UDP receiver threads of the server (--udp-threads). Default 1
+  -R <hz>        : Refresh rate of the server (--refresh-rate). Default 60
+USAGE
+    exit 1
+}
+
+CLIENTS=4
+RATE=60
+SECONDS_RUN=5
+MODE=full
+PART=9x7
+DISPLAY_SIZE=45x35
+THREADS=1
+REFRESH=60
+
+while getopts "c:r:t:m:s:D:T:R:h" opt; do
+    case $opt in
+        c) CLIENTS=$OPTARG ;;
+        r) RATE=$OPTARG ;;
+        t) SECONDS_RUN=$OPTARG ;;
+        m) MODE=$OPTARG ;;
+        s) PART=$OPTARG ;;
+        D) DISPLAY_SIZE=$OPTARG ;;
+        T) THREADS=$OPTARG ;;
+        R) REFRESH=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+cd "$(dirname "$0")"
+
+# The server needs to be built with the null display.
+make -s ft-loadgen
+make -s -C ../server FT_BACKEND=null
+cp ../server/ft-server ft-server-null
+
+# Field of the Udp: line in /proc/net/snmp. Counts are for the whole
+# machine, so better not have other UDP traffic going on.
+udp_stat() {
+    awk -v field="$1" '/^Udp:/ { if (!header) { for (i = 1; i <= NF; ++i)
+        if ($i == field) col = i; header = 1 } else print $col }' \
+        /proc/net/snmp 2>/dev/null || echo 0
+}
+
+SERVER_LOG=$(mktemp)
+LOADGEN_LOG=$(mktemp)
+trap 'rm -f "$SERVER_LOG" "$LOADGEN_LOG"' EXIT
+
+RCVBUF_ERRORS_BEFORE=$(udp_stat RcvbufErrors)
+
+./ft-server-null -D"$DISPLAY_SIZE" --latency-probes \
+                 --udp-threads "$THREADS" --refresh-rate "$REFRESH" \
+                 "$@" 2> "$SERVER_LOG" &
+SERVER_PID=$!
+sleep 0.5
+
+FT_DISPLAY=localhost ./ft-loadgen -D"$DISPLAY_SIZE" -c "$CLIENTS" \
+    -r "$RATE" -t "$SECONDS_RUN" -m "$MODE" -s "$PART" 2> "$LOADGEN_LOG"
+
+sleep 0.2   # Let the server catch up with the last packets.
+kill -INT $SERVER_PID
+wait $SERVER_PID || true
+
+RCVBUF_ERRORS_AFTER=$(udp_stat RcvbufErrors)
+
+echo "== clients=$CLIENTS rate=$RATE mode=$MODE display=$DISPLAY_SIZE" \
+     "udp-threads=$THREADS refresh-rate=$REFRESH"
+cat "$LOADGEN_LOG"
+grep -v "ready to listen" "$SERVER_LOG" || true
+
+PACKETS=$(sed -n 's/.* in \([0-9]*\) packets .*/\1/p' "$LOADGEN_LOG")
+DROPPED=$((RCVBUF_ERRORS_AFTER - RCVBUF_ERRORS_BEFORE))
+if [ -n "$PACKETS" ] && [ "$PACKETS" -gt 0 ]; then
+    awk -v d="$DROPPED" -v p="$PACKETS" \
+        'BEGIN { printf("dropped: %d of %d packets (%.2f%%)\n", d, p, 100.0 * d / p) }'
+fi
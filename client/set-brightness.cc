@@ -0,0 +1,65 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Change the brightness of a server running on this machine, e.g. from a
+// cron job to dim the installation at night.
+
+#include "local-flaschen-taschen.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static int usage(const char *progname) {
+    fprintf(stderr, "usage: %s [options] <percent>\n", progname);
+    fprintf(stderr, "Options:\n"
+            "\t-s <socket> : Local socket of the server (--local-socket).\n"
+            "\t              Default: FT_LOCAL_SOCKET environment variable\n"
+            "\t              or /tmp/flaschen-taschen.sock\n");
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *socket_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        switch (opt) {
+        case 's':
+            socket_path = optarg;
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        return usage(argv[0]);
+    char *end;
+    const long percent = strtol(argv[optind], &end, 10);
+    if (*end != '\0' || percent < 0 || percent > 100) {
+        fprintf(stderr, "Brightness must be 0..100\n");
+        return usage(argv[0]);
+    }
+
+    const int fd = OpenLocalFlaschenTaschenSocket(socket_path);
+    if (fd < 0)
+        return 1;
+    const bool success = SetLocalFlaschenTaschenBrightness(fd, percent);
+    close(fd);
+    if (!success) {
+        fprintf(stderr, "Server did not accept brightness change.\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "color-correction.h"
+
+#include <math.h>
+
+ColorCorrection::ColorCorrection() : gamma_(1.0), brightness_(100) {
+    balance_[0] = balance_[1] = balance_[2] = 100;
+    UpdateTables();
+}
+
+ColorCorrection::ColorCorrection(float gamma, int red, int green, int blue)
+    : gamma_(gamma > 0 ? gamma : 1.0), brightness_(100) {
+    balance_[0] = red;
+    balance_[1] = green;
+    balance_[2] = blue;
+    for (int c = 0; c < 3; ++c) {
+        if (balance_[c] < 0) balance_[c] = 0;
+        if (balance_[c] > 100) balance_[c] = 100;
+    }
+    UpdateTables();
+}
+
+void ColorCorrection::SetBrightness(int percent) {
+    if (percent < 0) percent = 0;
+    if (percent > 100) percent = 100;
+    if (percent == brightness_)
+        return;
+    brightness_ = percent;
+    UpdateTables();
+}
+
+void ColorCorrection::UpdateTables() {
+    identity_ = (gamma_ == 1.0 && brightness_ == 100);
+    for (int c = 0; c < 3; ++c) {
+        identity_ &= (balance_[c] == 100);
+        const double scale = 65535.0 * balance_[c] * brightness_ / 10000.0;
+        for (int i = 0; i < 256; ++i) {
+            const uint16_t value = lround(scale * pow(i / 255.0, gamma_));
+            wide_[c][i] = value;
+            narrow_[c][i] = (value * 255 + 32767) / 65535;
+        }
+    }
+}
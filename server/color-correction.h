@@ -0,0 +1,77 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef FT_COLOR_CORRECTION_H
+#define FT_COLOR_CORRECTION_H
+
+#include <stdint.h>
+
+#include "flaschen-taschen.h"
+
+// Gamma, color balance and brightness of the output, as one lookup table
+// per channel. Applied on the way to the display, so that clients can send
+// plain sRGB-ish values and don't need to know anything about the LEDs.
+//
+// Values are mapped to 16 bit, for outputs that can make use of more
+// depth than 8 bit, and to 8 bit for all others.
+class ColorCorrection {
+public:
+    // Identity: leaves all colors as they are.
+    ColorCorrection();
+
+    // "gamma" of 1.0 is linear. "red", "green", "blue" scale the channels,
+    // in percent.
+    ColorCorrection(float gamma, int red, int green, int blue);
+
+    // Overall brightness in percent, 0..100. Can be changed at any time.
+    void SetBrightness(int percent);
+    int brightness() const { return brightness_; }
+
+    // True if Map() doesn't change anything.
+    bool is_identity() const { return identity_; }
+
+    // Map "count" r,g,b pixels. "in" and "out" may be the same.
+    void Map(const uint8_t *in, int count, uint8_t *out) const {
+        for (int i = 0; i < count; ++i, in += 3, out += 3) {
+            out[0] = narrow_[0][in[0]];
+            out[1] = narrow_[1][in[1]];
+            out[2] = narrow_[2][in[2]];
+        }
+    }
+
+    Color Map(const Color &c) const {
+        return Color(narrow_[0][c.r], narrow_[1][c.g], narrow_[2][c.b]);
+    }
+
+    // Like Map(), but with 16 bit per channel output.
+    void MapWide(const uint8_t *in, int count, uint16_t *out) const {
+        for (int i = 0; i < count; ++i, in += 3, out += 3) {
+            out[0] = wide_[0][in[0]];
+            out[1] = wide_[1][in[1]];
+            out[2] = wide_[2][in[2]];
+        }
+    }
+
+private:
+    void UpdateTables();
+
+    float gamma_;
+    int balance_[3];
+    int brightness_;
+    bool identity_;
+    uint16_t wide_[3][256];
+    uint8_t narrow_[3][256];
+};
+
+#endif  // FT_COLOR_CORRECTION_H
@@ -15,34 +15,153 @@
 #include "led-flaschen-taschen.h"
 
 #include <unistd.h>
+#include "led-layout.h"
+#include "led-strip.h"
 #include "multi-spi.h"
 
-ColumnAssembly::ColumnAssembly(spixels::MultiSPI *spi)
-    : spi_(spi), width_(0), height_(0)  {}
+using spixels::MultiSPI;
+
+// Fraction bits of the 8.8 fixed point pixels that dithering uses. With
+// fewer, a pixel with a small fraction steps up more often, so at a high
+// refresh rate it doesn't blink visibly.
+static const int kDitherFractionBits = 4;
+static const int kDitherFractionMask
+    = ((1 << kDitherFractionBits) - 1) << (8 - kDitherFractionBits);
+
+// 4x4 Bayer matrix, to start the error of neighboring pixels at different
+// values, so that they don't step up all at the same time.
+static const uint8_t kBayer4x4[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+// Connector Pn of the layout is kConnectors[n-1].
+static const int kConnectors[] = {
+    MultiSPI::SPI_P1,  MultiSPI::SPI_P2,  MultiSPI::SPI_P3,  MultiSPI::SPI_P4,
+    MultiSPI::SPI_P5,  MultiSPI::SPI_P6,  MultiSPI::SPI_P7,  MultiSPI::SPI_P8,
+    MultiSPI::SPI_P9,  MultiSPI::SPI_P10, MultiSPI::SPI_P11, MultiSPI::SPI_P12,
+    MultiSPI::SPI_P13, MultiSPI::SPI_P14, MultiSPI::SPI_P15, MultiSPI::SPI_P16,
+};
+
+ColumnAssembly::ColumnAssembly(MultiSPI *spi, const LEDLayout &layout)
+    : spi_(spi), width_(layout.width()), height_(layout.height()),
+      dither_(false) {
+    for (size_t i = 0; i < layout.strips().size(); ++i) {
+        const LEDLayout::Strip &strip = layout.strips()[i];
+        strips_.push_back(spixels::CreateWS2801Strip(
+                              spi, kConnectors[strip.connector - 1],
+                              strip.length));
+    }
+    targets_.resize(width_ * height_);
+    const LEDLayout::Address *address = layout.addresses();
+    for (size_t i = 0; i < targets_.size(); ++i, ++address) {
+        targets_[i].strip = address->strip < 0 ? NULL : strips_[address->strip];
+        targets_[i].led = address->led;
+    }
+}
 
 ColumnAssembly::~ColumnAssembly() {
-    for (size_t i = 0; i < columns_.size(); ++i)
-        delete columns_[i];
+    for (size_t i = 0; i < strips_.size(); ++i)
+        delete strips_[i];
 }
 
-void ColumnAssembly::AddColumn(FlaschenTaschen *taschen) {
-    columns_.push_back(taschen);
-    width_ += 5;
-    height_ = std::max(height_, taschen->height());
+void ColumnAssembly::EnableDithering() {
+    dither_ = true;
+    precise_.resize(3 * targets_.size());
+    error_.resize(3 * targets_.size());
+    for (int y = 0; y < height_; ++y) {
+        for (int x = 0; x < width_; ++x) {
+            // 0..15 to a fraction of 0..255; shifted a row for each color.
+            uint8_t *const error = &error_[3 * (y * width_ + x)];
+            for (int c = 0; c < 3; ++c) {
+                error[c] = (kBayer4x4[(y + c) & 3][x & 3] << 4)
+                    & kDitherFractionMask;
+            }
+        }
+    }
 }
 
 void ColumnAssembly::SetPixel(int x, int y, const Color &col) {
     if (x < 0 || x >= width() || y < 0 || y >= height())
         return;
-    const int crate_from_left = x / 5;
-    FlaschenTaschen *column = columns_[columns_.size() - crate_from_left - 1];
+    if (dither_) {
+        uint16_t *const value = &precise_[3 * (y * width_ + x)];
+        value[0] = col.r << 8;
+        value[1] = col.g << 8;
+        value[2] = col.b << 8;
+        return;
+    }
+    const LEDTarget &target = targets_[y * width_ + x];
+    if (target.strip)
+        target.strip->SetPixel(target.led, col.r, col.g, col.b);
+}
+
+void ColumnAssembly::Blit(int x, int y, int w, int h,
+                          const uint8_t *rgb, size_t stride) {
+    if (!ClipToCanvas(&x, &y, &w, &h, &rgb, stride)) return;
+    if (dither_) {
+        for (int row = y; row < y + h; ++row, rgb += stride) {
+            uint16_t *value = &precise_[3 * (row * width_ + x)];
+            for (int i = 0; i < 3 * w; ++i)
+                value[i] = rgb[i] << 8;
+        }
+        return;
+    }
+    for (int row = y; row < y + h; ++row, rgb += stride) {
+        const uint8_t *pixel = rgb;
+        const LEDTarget *target = &targets_[row * width_ + x];
+        for (int col = 0; col < w; ++col, pixel += 3, ++target) {
+            if (target->strip)
+                target->strip->SetPixel(target->led,
+                                        pixel[0], pixel[1], pixel[2]);
+        }
+    }
+}
 
-    // Our physical display has the (0,0) at the bottom right corner.
-    // Flip it around.
-    column->SetPixel(4 - x % 5, height() - y - 1, col);
+void ColumnAssembly::BlitWide(int x, int y, int w, int h,
+                              const uint16_t *rgb, size_t stride) {
+    if (!dither_) return;
+    // Clip like ClipToCanvas(), which only deals with 8 bit pixels.
+    if (x < 0) { w += x; rgb += 3 * -x; x = 0; }
+    if (y < 0) {
+        h += y;
+        rgb = (const uint16_t*) ((const uint8_t*) rgb + stride * -y);
+        y = 0;
+    }
+    if (x + w > width_) w = width_ - x;
+    if (y + h > height_) h = height_ - y;
+    if (w <= 0 || h <= 0) return;
+    for (int row = y; row < y + h; ++row) {
+        uint16_t *value = &precise_[3 * (row * width_ + x)];
+        // 0..65535 to 8.8 fixed point 0..255.0
+        for (int i = 0; i < 3 * w; ++i)
+            value[i] = ((uint32_t)rgb[i] * 65280 + 32767) / 65535;
+        rgb = (const uint16_t*) ((const uint8_t*) rgb + stride);
+    }
 }
 
 void ColumnAssembly::Send() {
+    if (dither_) {
+        // Show the integer part; the fraction accumulates until it makes a
+        // full step. Over a few Send()s, the average is the precise value.
+        const uint16_t *value = &precise_[0];
+        uint8_t *error = &error_[0];
+        for (size_t i = 0; i < targets_.size(); ++i, value += 3, error += 3) {
+            uint8_t out[3];
+            for (int c = 0; c < 3; ++c) {
+                const int rounded = value[c] + (0x80 >> kDitherFractionBits);
+                const int sum = (rounded & (0xff00 | kDitherFractionMask))
+                    + error[c];
+                out[c] = sum >> 8;
+                error[c] = sum & kDitherFractionMask;
+            }
+            if (targets_[i].strip)
+                targets_[i].strip->SetPixel(targets_[i].led,
+                                            out[0], out[1], out[2]);
+        }
+    }
     spi_->SendBuffers();
     usleep(50);  // WS2801 triggers on 50usec no data.
 }
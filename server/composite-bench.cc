@@ -0,0 +1,124 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Microbenchmark of the composite display: time per pixel to set pixels
+// in various layer situations. Build with 'make composite-bench'.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <vector>
+
+#include "composite-flaschen-taschen.h"
+
+namespace {
+// Display that discards everything, so that we only measure compositing.
+class DiscardFlaschenTaschen : public ServerFlaschenTaschen {
+public:
+    DiscardFlaschenTaschen(int w, int h) : width_(w), height_(h) {}
+    int width() const { return width_; }
+    int height() const { return height_; }
+    void SetPixel(int x, int y, const Color &col) {}
+    void Blit(int x, int y, int w, int h, const uint8_t *rgb, size_t stride) {}
+    void Send() {}
+
+private:
+    const int width_;
+    const int height_;
+};
+
+int64_t CurrentTimeMicros() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+Color RandomColor() {
+    return Color(1 + random() % 255, random() % 256, random() % 256);
+}
+
+void FillLayer(CompositeFlaschenTaschen *display, int layer) {
+    display->SetLayer(layer);
+    for (int y = 0; y < display->height(); ++y)
+        for (int x = 0; x < display->width(); ++x)
+            display->SetPixel(x, y, RandomColor());
+}
+
+enum Mode { kOpaque, kTransparent, kHidden, kBlit };
+
+// Returns nanoseconds per pixel.
+double Run(Mode mode, int width, int height, int layers, int rounds) {
+    DiscardFlaschenTaschen discard(width, height);
+    CompositeFlaschenTaschen display(&discard, layers);
+    // Background and every other layer populated. For transparent pixels,
+    // only the background, so that all layers need to be looked at.
+    for (int layer = 0; layer < layers; layer += 2) {
+        FillLayer(&display, layer);
+        if (mode == kTransparent) break;
+    }
+    const int draw_layer = (mode == kHidden) ? 1 : layers - 1;
+    display.SetLayer(draw_layer);
+
+    std::vector<uint8_t> frame(3 * width * height);
+    for (size_t i = 0; i < frame.size(); ++i) frame[i] = random();
+    const Color black(0, 0, 0);
+
+    const int64_t start = CurrentTimeMicros();
+    for (int r = 0; r < rounds; ++r) {
+        if (mode == kBlit) {
+            display.Blit(0, 0, width, height, &frame[0], 3 * width);
+        } else {
+            const uint8_t *rgb = &frame[0];
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x, rgb += 3) {
+                    // Alternating the color makes sure the top layer
+                    // toggles between transparent and not.
+                    if (mode == kTransparent && (r & 1) == 0)
+                        display.SetPixel(x, y, black);
+                    else
+                        display.SetPixel(x, y, Color(rgb[0] | 1, rgb[1], rgb[2]));
+                }
+            }
+        }
+        display.Send();
+    }
+    const int64_t duration = CurrentTimeMicros() - start;
+    return 1000.0 * duration / ((double)rounds * width * height);
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    const int width = argc > 1 ? atoi(argv[1]) : 128;
+    const int height = argc > 2 ? atoi(argv[2]) : 128;
+    const int layers = argc > 3 ? atoi(argv[3]) : 16;
+    const int rounds = argc > 4 ? atoi(argv[4]) : 200;
+    if (width <= 0 || height <= 0 || layers < 2 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [<width> <height> <layers> <rounds>]\n",
+                argv[0]);
+        return 1;
+    }
+
+    printf("%dx%d, %d layers, %d rounds; ns per pixel:\n",
+           width, height, layers, rounds);
+    printf("  SetPixel() top layer, opaque             %7.2f\n",
+           Run(kOpaque, width, height, layers, rounds));
+    printf("  SetPixel() top layer, toggle transparent %7.2f\n",
+           Run(kTransparent, width, height, layers, rounds));
+    printf("  SetPixel() hidden below other layers     %7.2f\n",
+           Run(kHidden, width, height, layers, rounds));
+    printf("  Blit() top layer                         %7.2f\n",
+           Run(kBlit, width, height, layers, rounds));
+    return 0;
+}
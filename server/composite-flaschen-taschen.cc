@@ -18,12 +18,17 @@
 #include <assert.h>
 #include <limits.h>
 #include <pthread.h>
+#include <string.h>
 #include <strings.h>
+#include <sys/time.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <vector>
 
+#include "composite-kernel.h"
 #include "ft-thread.h"
+#include "triple-buffer.h"
 
 namespace {
 // A two-dimensional array, essentially.
@@ -38,6 +43,7 @@ public:
     ~TypedScreenBuffer() { delete [] screen_; }
 
     T &At(int x, int y) { return screen_[y * width_ + x]; }
+    const T *data() const { return screen_; }
 
 private:
     const int width_;
@@ -51,9 +57,15 @@ public:
     ScreenBuffer(int w, int h) : TypedScreenBuffer<Color>(w, h){}
 };
 
-class CompositeFlaschenTaschen::ZBuffer : public TypedScreenBuffer<int> {
+class CompositeFlaschenTaschen::LayerMaskBuffer
+    : public TypedScreenBuffer<LayerMask> {
 public:
-    ZBuffer(int w, int h) : TypedScreenBuffer<int>(w, h){}
+    LayerMaskBuffer(int w, int h) : TypedScreenBuffer<LayerMask>(w, h) {
+        // Only the background is occupied.
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x)
+                At(x, y) = 1;
+    }
 };
 
 class CompositeFlaschenTaschen::LayerGarbageCollector : public ft::Thread {
@@ -91,59 +103,287 @@ private:
     Ticks ticks_;
 };
 
-CompositeFlaschenTaschen::CompositeFlaschenTaschen(FlaschenTaschen *delegatee,
-                                                   int layers)
+// Pushes composited frames to the delegatee. Frames are handed over through
+// a triple buffer, so neither side has to wait for the other: the writer
+// publishes complete frames while holding the display lock, the output thread
+// picks up the latest one without taking that lock.
+//
+// The color correction is applied here, once per displayed frame; it has its
+// own copy of it, only the brightness is passed along with the frames.
+//
+// Displays that need continuous refresh, such as for dithering, get a Send()
+// each period even without new frames.
+class CompositeFlaschenTaschen::OutputThread : public ft::Thread {
+public:
+    OutputThread(ServerFlaschenTaschen *display, int refresh_hz,
+                 const ColorCorrection &correction)
+        : display_(display),
+          frame_period_usec_(refresh_hz > 0 ? 1000000 / refresh_hz : 0),
+          frames_(display->width(), display->height()),
+          pending_changes_(display->width(), display->height()),
+          changes_(display->width(), display->height()),
+          correction_(correction), corrected_row_(display->width()),
+          wide_row_(3 * display->width()),
+          running_(true), frame_published_(false),
+          pending_brightness_(correction.brightness()) {
+        pthread_cond_init(&wakeup_cond_, NULL);
+    }
+
+    void Run() {
+        const int width = frames_.width();
+        const bool continuous = display_->needs_continuous_refresh();
+        const bool wide = display_->has_wide_color();
+        for (;;) {
+            int brightness;
+            bool new_frame;
+            {
+                // Only protects the wakeup and change tracking, not the
+                // frame data.
+                ft::MutexLock m(&wakeup_lock_);
+                while (running_ && !frame_published_ && !continuous)
+                    wakeup_lock_.WaitOn(&wakeup_cond_);
+                if (!running_) break;
+                new_frame = frame_published_;
+                frame_published_ = false;
+                // Changes of frames we skip accumulate. Take them before
+                // acquiring the frame, so that we never miss any.
+                changes_.Add(pending_changes_);
+                pending_changes_.Clear();
+                brightness = pending_brightness_;
+            }
+            const int64_t start_usec = CurrentTimeMicros();
+            // A frame published after we took the changes above is acquired
+            // with the changes of an earlier one; its own changes come with
+            // the next round, which then has no new frame to acquire. So the
+            // front frame is shown whenever there are changes.
+            const bool acquired = new_frame && frames_.AcquireLatest();
+            if (acquired || !changes_.empty()) {
+                correction_.SetBrightness(brightness);
+                ShowChanges(frames_.front(), width, wide);
+            } else if (continuous) {
+                display_->Send();   // Same content, next dithering step.
+            } else {
+                continue;
+            }
+
+            // Don't update more often than the configured refresh rate.
+            const int64_t elapsed = CurrentTimeMicros() - start_usec;
+            if (elapsed < frame_period_usec_) {
+                usleep(frame_period_usec_ - elapsed);
+            }
+        }
+    }
+
+    // Producer side: publish a new frame, in which "changes" differ from the
+    // previous one, to be shown with the given brightness.
+    void PublishFrame(const Color *frame, const DirtyRegion &changes,
+                      int brightness) {
+        memcpy(frames_.back(), frame,
+               frames_.width() * frames_.height() * sizeof(Color));
+        frames_.Publish();
+        ft::MutexLock m(&wakeup_lock_);
+        pending_changes_.Add(changes);
+        pending_brightness_ = brightness;
+        frame_published_ = true;
+        pthread_cond_signal(&wakeup_cond_);
+    }
+
+    void TriggerExit() {
+        ft::MutexLock m(&wakeup_lock_);
+        running_ = false;
+        pthread_cond_signal(&wakeup_cond_);
+    }
+
+private:
+    void ShowChanges(const Color *frame, int width, bool wide) {
+        const bool correct = !correction_.is_identity();
+        for (int y = changes_.first_row(); y < changes_.last_row(); ++y) {
+            if (!changes_.row_dirty(y)) continue;
+            const int x = changes_.begin(y);
+            const int w = changes_.end(y) - x;
+            const uint8_t *row = (const uint8_t*) (frame + y * width + x);
+            if (wide) {
+                correction_.MapWide(row, w, &wide_row_[0]);
+                display_->BlitWide(x, y, w, 1, &wide_row_[0],
+                                   wide_row_.size() * sizeof(uint16_t));
+                continue;
+            }
+            if (correct) {
+                correction_.Map(row, w, (uint8_t*) &corrected_row_[0]);
+                row = (const uint8_t*) &corrected_row_[0];
+            }
+            display_->Blit(x, y, w, 1, row, width * sizeof(Color));
+        }
+        display_->SendPartial(changes_);
+        changes_.Clear();
+    }
+
+    static int64_t CurrentTimeMicros() {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    }
+
+    ServerFlaschenTaschen *const display_;
+    const int64_t frame_period_usec_;
+    TripleBuffer frames_;
+    DirtyRegion pending_changes_;  // Changes published, not yet displayed.
+    DirtyRegion changes_;          // Changes to display in this round.
+    ColorCorrection correction_;
+    std::vector<Color> corrected_row_;
+    std::vector<uint16_t> wide_row_;
+    ft::Mutex wakeup_lock_;
+    pthread_cond_t wakeup_cond_;
+    bool running_;
+    bool frame_published_;
+    int pending_brightness_;
+};
+
+CompositeFlaschenTaschen::CompositeFlaschenTaschen(
+    ServerFlaschenTaschen *delegatee, int layers)
     : delegatee_(delegatee),
       width_(delegatee->width()), height_(delegatee->height()),
       current_layer_(0), any_visible_pixel_drawn_(false),
-      z_buffer_(new ZBuffer(width_, height_)),
-      garbage_collect_(NULL) {
-    assert(layers < 32);  // otherwise could getting slow.
+      layer_mask_(new LayerMaskBuffer(width_, height_)),
+      visible_(new ScreenBuffer(width_, height_)),
+      dirty_(width_, height_), corrected_row_(width_), wide_row_(3 * width_),
+      garbage_collect_(NULL), output_thread_(NULL) {
+    assert(layers <= kMaxLayers);  // Need a bit for each.
     for (int i = 0; i < layers; ++i) {
         screens_.push_back(new ScreenBuffer(delegatee->width(),
                                             delegatee->height()));
         last_layer_update_time_.push_back(INT_MAX);
     }
+    const Area empty = { width_, height_, 0, 0 };
+    layer_area_.resize(layers, empty);
 }
 
 CompositeFlaschenTaschen::~CompositeFlaschenTaschen() {
     if (garbage_collect_) {
         garbage_collect_->TriggerExit();
         garbage_collect_->WaitStopped();
+        delete garbage_collect_;
+    }
+    if (output_thread_) {
+        output_thread_->TriggerExit();
+        output_thread_->WaitStopped();
+        delete output_thread_;
     }
     for (size_t i = 0; i < screens_.size(); ++i) delete screens_[i];
-    delete z_buffer_;
+    delete layer_mask_;
+    delete visible_;
 }
 
 void CompositeFlaschenTaschen::SetPixel(int x, int y, const Color &col) {
     if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
     SetPixelAtLayer(x, y, current_layer_, col);
+    if (!output_thread_) {
+        if (delegatee_->has_wide_color())
+            UpdateDelegatee(x, y, 1, 1);
+        else
+            delegatee_->SetPixel(x, y, correction_.Map(visible_->At(x, y)));
+    }
+}
+
+void CompositeFlaschenTaschen::Blit(int x, int y, int w, int h,
+                                    const uint8_t *rgb, size_t stride) {
+    if (!ClipToCanvas(&x, &y, &w, &h, &rgb, stride)) return;
+    // Local copies: the compiler can't know that writing Colors doesn't
+    // change our members.
+    const int layer = current_layer_;
+    ScreenBuffer *const *const screens = &screens_[0];
+    for (int row = y; row < y + h; ++row, rgb += stride) {
+        Color *const layer_row = &screens[layer]->At(x, row);
+        memcpy(layer_row, rgb, w * sizeof(Color));
+        LayerMask *const mask = &layer_mask_->At(x, row);
+        if (layer > 0)
+            UpdateLayerMasks(layer_row, w, layer, mask);
+        // Pixels not covered by higher layers are visible changes.
+        Color *const visible = &visible_->At(x, row);
+        int first = w, last = -1;
+        for (int i = 0; i < w; ++i) {
+            const int top = TopLayer(mask[i]);
+            if (top > layer)
+                continue;
+            visible[i] = (top == layer)
+                ? layer_row[i] : screens[top]->At(x + i, row);
+            if (first > i) first = i;
+            last = i;
+        }
+        if (last >= first) {
+            dirty_.Add(x + first, row, last - first + 1, 1);
+            any_visible_pixel_drawn_ = true;
+        }
+    }
+    if (layer > 0)
+        GrowLayerArea(layer, x, y, w, h);
+    UpdateDelegatee(x, y, w, h);
+}
+
+void CompositeFlaschenTaschen::GrowLayerArea(int layer,
+                                             int x, int y, int w, int h) {
+    Area &area = layer_area_[layer];
+    area.x0 = std::min(area.x0, x);
+    area.y0 = std::min(area.y0, y);
+    area.x1 = std::max(area.x1, x + w);
+    area.y1 = std::max(area.y1, y + h);
+}
+
+void CompositeFlaschenTaschen::UpdateDelegatee(int x, int y, int w, int h) {
+    if (output_thread_) return;  // Will pick up the whole frame on Send()
+    if (delegatee_->has_wide_color()) {
+        for (int row = y; row < y + h; ++row) {
+            correction_.MapWide((const uint8_t*) &visible_->At(x, row), w,
+                                &wide_row_[0]);
+            delegatee_->BlitWide(x, row, w, 1, &wide_row_[0],
+                                 wide_row_.size() * sizeof(uint16_t));
+        }
+        return;
+    }
+    if (correction_.is_identity()) {
+        delegatee_->Blit(x, y, w, h, (const uint8_t*) &visible_->At(x, y),
+                         width_ * sizeof(Color));
+        return;
+    }
+    for (int row = y; row < y + h; ++row) {
+        uint8_t *const corrected = (uint8_t*) &corrected_row_[0];
+        correction_.Map((const uint8_t*) &visible_->At(x, row), w, corrected);
+        delegatee_->Blit(x, row, w, 1, corrected, width_ * sizeof(Color));
+    }
 }
 
 void CompositeFlaschenTaschen::Send() {
     // Don't send anything if we only had pixels in hidden layers.
-    if (any_visible_pixel_drawn_)
-        delegatee_->Send();
+    if (any_visible_pixel_drawn_) {
+        if (output_thread_)
+            output_thread_->PublishFrame(visible_->data(), dirty_,
+                                         correction_.brightness());
+        else
+            delegatee_->SendPartial(dirty_);
+    }
+    dirty_.Clear();
     any_visible_pixel_drawn_ = false;
 }
 
 void CompositeFlaschenTaschen::SetPixelAtLayer(int x, int y, int layer,
                                                const Color &col) {
     screens_[layer]->At(x, y) = col;
-    if (layer >= z_buffer_->At(x, y)) {
-        any_visible_pixel_drawn_ = true;
+    LayerMask &mask = layer_mask_->At(x, y);
+    if (layer > 0) {  // Background always is opaque.
+        const LayerMask bit = (LayerMask)1 << layer;
         if (col.is_black()) {
-            // Transparent pixel. Find closest stacked below us that is not.
-            for (/**/; layer > 0; --layer) {
-                if (!screens_[layer]->At(x, y).is_black())
-                    break;
-            }
-            delegatee_->SetPixel(x, y, screens_[layer]->At(x, y));
+            mask &= ~bit;   // Transparent pixel.
         } else {
-            delegatee_->SetPixel(x, y, col);
+            mask |= bit;
+            GrowLayerArea(layer, x, y, 1, 1);
         }
-        z_buffer_->At(x, y) = layer;
     }
+    const int top = TopLayer(mask);
+    if (top > layer)
+        return;  // Hidden behind a higher layer.
+    any_visible_pixel_drawn_ = true;
+    visible_->At(x, y) = screens_[top]->At(x, y);
+    dirty_.Add(x, y, 1, 1);
 }
 
 void CompositeFlaschenTaschen::SetLayer(int layer) {
@@ -161,21 +401,76 @@ void CompositeFlaschenTaschen::StartLayerGarbageCollection(ft::Mutex *lock,
     garbage_collect_->Start();
 }
 
+void CompositeFlaschenTaschen::StartOutputThread(int refresh_hz) {
+    assert(output_thread_ == NULL);  // only start once.
+    output_thread_ = new OutputThread(delegatee_, refresh_hz, correction_);
+    output_thread_->Start();
+}
+
+void CompositeFlaschenTaschen::SetColorCorrection(
+    const ColorCorrection &correction) {
+    assert(output_thread_ == NULL);  // It has its own copy.
+    correction_ = correction;
+}
+
+void CompositeFlaschenTaschen::SetBrightness(int percent) {
+    correction_.SetBrightness(percent);
+    dirty_.AddAll();
+    UpdateDelegatee(0, 0, width_, height_);
+    any_visible_pixel_drawn_ = true;
+}
+
 void CompositeFlaschenTaschen::ClearLayersOlderThan(Ticks cutoff_time) {
-    const Color black(0, 0, 0);
-    bool any_change = false;
-    // Only cleaning layers above zero (= background)
+    // Only cleaning layers above zero (= background).
+    LayerMask expired = 0;
     for (size_t layer = 1; layer < last_layer_update_time_.size(); ++layer) {
         if (last_layer_update_time_[layer] > cutoff_time)
             continue;
-        // Not very efficient, but good for now:
-        for (int x = 0; x < width_; ++x) {
-            for (int y = 0; y < height_; ++y) {
-                SetPixelAtLayer(x, y, layer, black);
-            }
-        }
         last_layer_update_time_[layer] = INT_MAX;
-        any_change = true;
+        expired |= (LayerMask)1 << layer;
+    }
+    if (expired == 0)
+        return;
+    ExpireLayers(expired);
+    Send();
+}
+
+void CompositeFlaschenTaschen::ExpireLayers(LayerMask expired) {
+    // The content of expired layers stays, but as their bits are cleared,
+    // it is never looked at again until overwritten. Only the area each
+    // layer was drawn in is looked at; where areas overlap, the bits are
+    // already cleared the second time.
+    for (size_t layer = 1; layer < layer_area_.size(); ++layer) {
+        if ((expired & ((LayerMask)1 << layer)) == 0)
+            continue;
+        const Area area = layer_area_[layer];
+        const Area empty = { width_, height_, 0, 0 };
+        layer_area_[layer] = empty;
+        ExpireArea(expired, area.x0, area.y0, area.x1, area.y1);
+    }
+}
+
+void CompositeFlaschenTaschen::ExpireArea(LayerMask expired,
+                                          int x0, int y0, int x1, int y1) {
+    for (int y = y0; y < y1; ++y) {
+        LayerMask *const mask = &layer_mask_->At(0, y);
+        int first = width_, last = -1;
+        for (int x = x0; x < x1; ++x) {
+            if ((mask[x] & expired) == 0)
+                continue;
+            const int previous_top = TopLayer(mask[x]);
+            mask[x] &= ~expired;
+            const int top = TopLayer(mask[x]);
+            if (top == previous_top)
+                continue;
+            visible_->At(x, y) = screens_[top]->At(x, y);
+            if (first > x) first = x;
+            last = x;
+        }
+        if (last >= first) {
+            dirty_.Add(first, y, last - first + 1, 1);
+            UpdateDelegatee(first, y, last - first + 1, 1);
+            any_visible_pixel_drawn_ = true;
+        }
     }
-    if (any_change) Send();
 }
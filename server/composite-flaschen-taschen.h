@@ -16,7 +16,11 @@
 #ifndef COMPOSITE_FLASCHEN_TASCHEN_H_
 #define COMPOSITE_FLASCHEN_TASCHEN_H_
 
+#include "color-correction.h"
+#include "composite-kernel.h"
+#include "dirty-region.h"
 #include "flaschen-taschen.h"
+#include "led-flaschen-taschen.h"
 
 #include <vector>
 
@@ -36,7 +40,7 @@ class Mutex;
 class CompositeFlaschenTaschen : public FlaschenTaschen {
 public:
     // Does _not_ take over ownership of delegatee.
-    CompositeFlaschenTaschen(FlaschenTaschen *delegatee, int layers);
+    CompositeFlaschenTaschen(ServerFlaschenTaschen *delegatee, int layers);
     ~CompositeFlaschenTaschen();
 
     virtual int width() const { return width_; }
@@ -46,6 +50,10 @@ public:
     virtual void SetPixel(int x, int y, const Color &col);
     virtual void Send();
 
+    // Copy a rectangle of pixels to the currently configured layer.
+    virtual void Blit(int x, int y, int w, int h,
+                      const uint8_t *rgb, size_t stride);
+
     // -- Layering features
 
     // Set layer for subsequent SetPixel() operations.
@@ -56,18 +64,47 @@ public:
     // "timeout_seconds". Uses mutex for exclusive access to display.
     void StartLayerGarbageCollection(ft::Mutex *lock,
                                      int timeout_seconds);
+
+    // Start a thread that updates the delegatee display with the latest
+    // composited frame, at most "refresh_hz" times per second.
+    // After this, Send() only publishes the frame and returns immediately;
+    // the delegatee is exclusively accessed from the output thread, so slow
+    // displays don't hold up the callers. Frames are exchanged lock-free,
+    // the output thread never contends for the display mutex.
+    void StartOutputThread(int refresh_hz);
+
+    // -- Output color correction
+
+    // Correct the colors on their way to the delegatee, see ColorCorrection.
+    // Must be set before the output thread is started.
+    void SetColorCorrection(const ColorCorrection &correction);
+
+    // Change the brightness of the color correction. Everything visible is
+    // passed on to the delegatee again with the next Send().
+    void SetBrightness(int percent);
+
 private:
     typedef int Ticks;
     class ScreenBuffer;
-    class ZBuffer;
+    class LayerMaskBuffer;
     class LayerGarbageCollector;
+    class OutputThread;
     friend class LayerGarbageCollector;
 
     void SetPixelAtLayer(int x, int y, int layer, const Color &col);
+
+    // Unless there is an output thread, pass the given area of the visible
+    // frame on to the delegatee.
+    void UpdateDelegatee(int x, int y, int w, int h);
     void SetTimeTicks(Ticks t) { current_time_ = t; }
     void ClearLayersOlderThan(Ticks t);
 
-    FlaschenTaschen *const delegatee_;
+    // Remove the given layers from all pixels and re-resolve the pixels
+    // in which one of them was the visible one.
+    void ExpireLayers(LayerMask expired);
+    void ExpireArea(LayerMask expired, int x0, int y0, int x1, int y1);
+
+    ServerFlaschenTaschen *const delegatee_;
     const int width_;
     const int height_;
     int current_layer_;
@@ -75,10 +112,25 @@ private:
     Ticks current_time_;
 
     std::vector<ScreenBuffer*> screens_;
-    ZBuffer *z_buffer_;
+    LayerMaskBuffer *layer_mask_;  // Non-black layers in each pixel.
+    ScreenBuffer *visible_;  // Result of compositing all layers.
+    DirtyRegion dirty_;      // Visible changes since last Send()
     std::vector<Ticks> last_layer_update_time_;
 
+    // For each layer, a rectangle containing all pixels in which it might
+    // be non-black, so that expiring it only looks at those.
+    struct Area {
+        int x0, y0, x1, y1;   // [x0, x1) x [y0, y1); empty if x0 >= x1.
+    };
+    void GrowLayerArea(int layer, int x, int y, int w, int h);
+    std::vector<Area> layer_area_;
+
+    ColorCorrection correction_;
+    std::vector<Color> corrected_row_;  // Without output thread.
+    std::vector<uint16_t> wide_row_;
+
     LayerGarbageCollector *garbage_collect_;
+    OutputThread *output_thread_;
 };
 
 #endif // COMPOSITE_FLASCHEN_TASCHEN_H_
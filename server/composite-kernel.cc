@@ -0,0 +1,226 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "composite-kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define FT_X86_SIMD 1
+#  include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  define FT_NEON_SIMD 1
+#  include <arm_neon.h>
+#endif
+
+// All implementations set "bit" in the mask of each pixel in "src" that is
+// not black and clear it for the black ones. Pixels are r,g,b byte triples.
+typedef void (*MaskFunction)(const uint8_t *src, LayerMask bit, int count,
+                             LayerMask *masks);
+
+static void UpdateMasksScalar(const uint8_t *src, LayerMask bit, int count,
+                              LayerMask *masks) {
+    for (int i = 0; i < count; ++i, src += 3) {
+        const LayerMask visible = -(LayerMask)((src[0] | src[1] | src[2]) != 0);
+        masks[i] = (masks[i] & ~bit) | (visible & bit);
+    }
+}
+
+#if FT_NEON_SIMD
+// NEON can de-interleave 16 r,g,b pixels into three registers on load, the
+// resulting per-pixel byte is then widened to the 64 bit of the masks.
+static void UpdateMasksNeon(const uint8_t *src, LayerMask bit, int count,
+                            LayerMask *masks) {
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint64x2_t bit_vec = vdupq_n_u64(bit);
+    int i = 0;
+    for (/**/; i + 16 <= count; i += 16, src += 48) {
+        const uint8x16x3_t s = vld3q_u8(src);
+        const int8x16_t visible = vreinterpretq_s8_u8(  // -1 if non-black.
+            vcgtq_u8(vorrq_u8(vorrq_u8(s.val[0], s.val[1]), s.val[2]), zero));
+        const int16x8_t v16[2] = { vmovl_s8(vget_low_s8(visible)),
+                                   vmovl_s8(vget_high_s8(visible)) };
+        for (int a = 0; a < 2; ++a) {
+            const int32x4_t v32[2] = { vmovl_s16(vget_low_s16(v16[a])),
+                                       vmovl_s16(vget_high_s16(v16[a])) };
+            for (int b = 0; b < 2; ++b) {
+                const int64x2_t v64[2] = { vmovl_s32(vget_low_s32(v32[b])),
+                                           vmovl_s32(vget_high_s32(v32[b])) };
+                for (int c = 0; c < 2; ++c) {
+                    uint64_t *const m = masks + i + 8 * a + 4 * b + 2 * c;
+                    vst1q_u64(m, vorrq_u64(
+                                  vbicq_u64(vld1q_u64(m), bit_vec),
+                                  vandq_u64(vreinterpretq_u64_s64(v64[c]),
+                                            bit_vec)));
+                }
+            }
+        }
+    }
+    UpdateMasksScalar(src, bit, count - i, masks + i);
+}
+#endif
+
+#if FT_X86_SIMD
+// On x86, we process 16 pixels in three 16 byte registers. Pixels straddle
+// register boundaries, so we need byte shuffles to get from a per-byte
+// "non-zero" mask to a "pixel is visible" byte, which is then spread to
+// the 8 bytes of the corresponding mask.
+namespace {
+struct ShuffleTables {
+    ShuffleTables() {
+        for (int c = 0; c < 3; ++c) {
+            for (int reg = 0; reg < 3; ++reg) {
+                for (int pixel = 0; pixel < 16; ++pixel) {
+                    const int byte = 3 * pixel + c;
+                    gather[c][reg][pixel] = (byte / 16 == reg)
+                        ? byte % 16 : 0x80;   // 0x80: shuffle in zero.
+                }
+            }
+        }
+        for (int pair = 0; pair < 8; ++pair) {
+            for (int i = 0; i < 16; ++i) {
+                expand[pair][i] = 2 * pair + i / 8;
+            }
+        }
+    }
+
+    // gather[c][reg]: collect byte c of each of the 16 pixels from register
+    // "reg" (where present) into a per-pixel vector.
+    uint8_t gather[3][3][16];
+
+    // expand[pair]: distribute the per-pixel vector entries of pixels
+    // 2*pair and 2*pair+1 to two 64 bit lanes.
+    uint8_t expand[8][16];
+};
+static const ShuffleTables kShuffle;
+
+__attribute__((target("ssse3")))
+static void UpdateMasksSSSE3(const uint8_t *src, LayerMask bit, int count,
+                             LayerMask *masks) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_cmpeq_epi8(zero, zero);
+    const __m128i bit_vec = _mm_set1_epi64x(bit);
+    int i = 0;
+    for (/**/; i + 16 <= count; i += 16, src += 48) {
+        __m128i visible = zero;   // 0xff for each non-black pixel.
+        for (int reg = 0; reg < 3; ++reg) {
+            const __m128i s = _mm_loadu_si128((const __m128i*)(src + 16*reg));
+            const __m128i non_zero
+                = _mm_xor_si128(_mm_cmpeq_epi8(s, zero), ones);
+            for (int c = 0; c < 3; ++c) {
+                const __m128i gather
+                    = _mm_loadu_si128((const __m128i*)kShuffle.gather[c][reg]);
+                visible = _mm_or_si128(visible,
+                                       _mm_shuffle_epi8(non_zero, gather));
+            }
+        }
+        for (int pair = 0; pair < 8; ++pair) {
+            const __m128i expand
+                = _mm_loadu_si128((const __m128i*)kShuffle.expand[pair]);
+            __m128i *const m = (__m128i*)(masks + i + 2 * pair);
+            const __m128i result = _mm_or_si128(
+                _mm_andnot_si128(bit_vec, _mm_loadu_si128(m)),
+                _mm_and_si128(_mm_shuffle_epi8(visible, expand), bit_vec));
+            _mm_storeu_si128(m, result);
+        }
+    }
+    UpdateMasksScalar(src, bit, count - i, masks + i);
+}
+
+// AVX2 shuffles only within 128 bit lanes, so each lane processes its own
+// group of 16 pixels with the same tables as above: 32 pixels per round.
+__attribute__((target("avx2")))
+static inline __m256i LoadTwoLanes(const void *lo, const void *hi) {
+    return _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)lo)),
+        _mm_loadu_si128((const __m128i*)hi), 1);
+}
+
+__attribute__((target("avx2")))
+static void UpdateMasksAVX2(const uint8_t *src, LayerMask bit, int count,
+                            LayerMask *masks) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_cmpeq_epi8(zero, zero);
+    const __m256i bit_vec = _mm256_set1_epi64x(bit);
+    int i = 0;
+    for (/**/; i + 32 <= count; i += 32, src += 96) {
+        __m256i visible = zero;
+        for (int reg = 0; reg < 3; ++reg) {
+            const __m256i s = LoadTwoLanes(src + 16 * reg, src + 48 + 16 * reg);
+            const __m256i non_zero
+                = _mm256_xor_si256(_mm256_cmpeq_epi8(s, zero), ones);
+            for (int c = 0; c < 3; ++c) {
+                const uint8_t *g = kShuffle.gather[c][reg];
+                visible = _mm256_or_si256(
+                    visible, _mm256_shuffle_epi8(non_zero,
+                                                 LoadTwoLanes(g, g)));
+            }
+        }
+        // Lane 0 has pixels 0..15, lane 1 pixels 16..31.
+        for (int pair = 0; pair < 8; ++pair) {
+            const uint8_t *e = kShuffle.expand[pair];
+            LayerMask *const lo = masks + i + 2 * pair;
+            LayerMask *const hi = masks + i + 16 + 2 * pair;
+            const __m256i result = _mm256_or_si256(
+                _mm256_andnot_si256(bit_vec, LoadTwoLanes(lo, hi)),
+                _mm256_and_si256(_mm256_shuffle_epi8(visible,
+                                                     LoadTwoLanes(e, e)),
+                                 bit_vec));
+            _mm_storeu_si128((__m128i*)lo, _mm256_castsi256_si128(result));
+            _mm_storeu_si128((__m128i*)hi,
+                             _mm256_extracti128_si256(result, 1));
+        }
+    }
+    UpdateMasksSSSE3(src, bit, count - i, masks + i);
+}
+}  // namespace
+#endif
+
+namespace {
+struct MaskImplementation {
+    MaskImplementation() : function(&UpdateMasksScalar), name("scalar") {
+#if FT_NEON_SIMD
+        function = &UpdateMasksNeon;
+        name = "NEON";
+#endif
+#if FT_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            function = &UpdateMasksAVX2;
+            name = "AVX2";
+        } else if (__builtin_cpu_supports("ssse3")) {
+            function = &UpdateMasksSSSE3;
+            name = "SSSE3";
+        }
+#endif
+    }
+    MaskFunction function;
+    const char *name;
+};
+}  // namespace
+
+static const MaskImplementation &GetMaskImplementation() {
+    static const MaskImplementation implementation;
+    return implementation;
+}
+
+void UpdateLayerMasks(const Color *pixels, int count, int layer,
+                      LayerMask *masks) {
+    GetMaskImplementation().function((const uint8_t*) pixels,
+                                     (LayerMask)1 << layer, count, masks);
+}
+
+const char *LayerMaskImplementation() {
+    return GetMaskImplementation().name;
+}
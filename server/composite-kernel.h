@@ -0,0 +1,46 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Per-pixel layer occupancy for compositing layers, in which black is
+// transparent.
+
+#ifndef FT_COMPOSITE_KERNEL_H
+#define FT_COMPOSITE_KERNEL_H
+
+#include <stdint.h>
+
+#include "flaschen-taschen.h"
+
+// Bit n is set if layer n is not black in that pixel. The background,
+// layer 0, is opaque, so bit 0 is always set.
+typedef uint64_t LayerMask;
+static const int kMaxLayers = 8 * sizeof(LayerMask);
+
+// The layer visible in a pixel with the given mask.
+static inline int TopLayer(LayerMask mask) {
+    return 63 - __builtin_clzll(mask);
+}
+
+// For each of the "count" pixels, set the bit for "layer" in "masks" if the
+// pixel is not black, clear it otherwise. "layer" must be larger than 0.
+//
+// Uses NEON on ARM and SSSE3/AVX2 on x86 if available, with a scalar
+// fallback otherwise.
+void UpdateLayerMasks(const Color *pixels, int count, int layer,
+                      LayerMask *masks);
+
+// Name of the implementation UpdateLayerMasks() uses on this machine.
+const char *LayerMaskImplementation();
+
+#endif  // FT_COMPOSITE_KERNEL_H
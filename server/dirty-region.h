@@ -0,0 +1,79 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef FT_DIRTY_REGION_H
+#define FT_DIRTY_REGION_H
+
+#include <algorithm>
+#include <vector>
+
+// Area of a display that changed since the last update: for each row, the
+// range of columns [begin(y), end(y)) that contains all changed pixels.
+class DirtyRegion {
+public:
+    DirtyRegion(int width, int height)
+        : width_(width), begin_(height, width), end_(height, 0),
+          first_row_(height), last_row_(0) {}
+
+    int width() const { return width_; }
+    int height() const { return (int)begin_.size(); }
+
+    // Changed rows are in the range [first_row(), last_row()).
+    int first_row() const { return first_row_; }
+    int last_row() const { return last_row_; }
+    bool empty() const { return first_row_ >= last_row_; }
+
+    // Range of changed columns in row y. Empty if begin(y) >= end(y).
+    int begin(int y) const { return begin_[y]; }
+    int end(int y) const { return end_[y]; }
+    bool row_dirty(int y) const { return begin_[y] < end_[y]; }
+
+    // Mark rectangle as changed. Must be within the display.
+    void Add(int x, int y, int w, int h) {
+        if (w <= 0 || h <= 0) return;
+        for (int row = y; row < y + h; ++row) {
+            begin_[row] = std::min(begin_[row], x);
+            end_[row] = std::max(end_[row], x + w);
+        }
+        first_row_ = std::min(first_row_, y);
+        last_row_ = std::max(last_row_, y + h);
+    }
+
+    void AddAll() { Add(0, 0, width(), height()); }
+
+    void Add(const DirtyRegion &other) {
+        for (int y = other.first_row_; y < other.last_row_; ++y) {
+            if (other.row_dirty(y))
+                Add(other.begin_[y], y, other.end_[y] - other.begin_[y], 1);
+        }
+    }
+
+    void Clear() {
+        for (int y = first_row_; y < last_row_; ++y) {
+            begin_[y] = width_;
+            end_[y] = 0;
+        }
+        first_row_ = height();
+        last_row_ = 0;
+    }
+
+private:
+    const int width_;
+    std::vector<int> begin_;
+    std::vector<int> end_;
+    int first_row_;
+    int last_row_;
+};
+
+#endif  // FT_DIRTY_REGION_H
@@ -0,0 +1,190 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "event-loop.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#  include <sys/epoll.h>
+#endif
+
+#include <algorithm>
+
+#include "composite-flaschen-taschen.h"
+#include "ft-thread.h"
+
+// Events taken from the kernel per round.
+static const int kMaxEvents = 64;
+
+static int64_t MonotonicMillis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+EventLoop::EventLoop(CompositeFlaschenTaschen *display, ft::Mutex *mutex)
+    : display_(display), mutex_(mutex),
+#ifdef __linux__
+      epoll_fd_(epoll_create1(EPOLL_CLOEXEC))
+#else
+      epoll_fd_(-1)
+#endif
+{
+}
+
+EventLoop::~EventLoop() {
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        delete entries_[i].handler;
+    }
+    if (epoll_fd_ >= 0) close(epoll_fd_);
+}
+
+bool EventLoop::Add(int fd, EventHandler *handler) {
+#ifdef __linux__
+    if (epoll_fd_ >= 0) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = handler;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl()");
+            delete handler;
+            return false;
+        }
+    }
+#endif
+    Entry entry;
+    entry.fd = fd;
+    entry.handler = handler;
+    entry.removed = false;
+    entries_.push_back(entry);
+    return true;
+}
+
+void EventLoop::Remove(EventHandler *handler) {
+    Entry *const entry = Find(handler);
+    if (entry == NULL || entry->removed)
+        return;
+#ifdef __linux__
+    if (epoll_fd_ >= 0) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, entry->fd, NULL);
+    }
+#endif
+    entry->removed = true;
+}
+
+EventLoop::Entry *EventLoop::Find(EventHandler *handler) {
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        if (entries_[i].handler == handler) return &entries_[i];
+    }
+    return NULL;
+}
+
+int EventLoop::NextTimeout(int64_t now_ms) const {
+    int timeout = -1;
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        const int t = entries_[i].handler->TimeToNextDeadline(now_ms);
+        if (t >= 0 && (timeout < 0 || t < timeout))
+            timeout = t;
+    }
+    return timeout;
+}
+
+void EventLoop::MarkReady(EventHandler *handler) {
+    if (std::find(ready_.begin(), ready_.end(), handler) == ready_.end())
+        ready_.push_back(handler);
+}
+
+void EventLoop::DeleteRemoved() {
+    for (size_t i = 0; i < entries_.size(); /**/) {
+        if (entries_[i].removed) {
+            delete entries_[i].handler;
+            entries_.erase(entries_.begin() + i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+bool EventLoop::RunOnce() {
+    const int timeout = NextTimeout(MonotonicMillis());
+
+    // Handlers with input, in the order reported.
+    std::vector<EventHandler*> readable;
+#ifdef __linux__
+    if (epoll_fd_ >= 0) {
+        struct epoll_event events[kMaxEvents];
+        const int count = epoll_wait(epoll_fd_, events, kMaxEvents, timeout);
+        if (count < 0)
+            return errno == EINTR;
+        for (int i = 0; i < count; ++i) {
+            readable.push_back((EventHandler*) events[i].data.ptr);
+        }
+    } else
+#endif
+    {
+        std::vector<struct pollfd> fds(entries_.size());
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            fds[i].fd = entries_[i].fd;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        const int count = poll(fds.empty() ? NULL : &fds[0], fds.size(),
+                               timeout);
+        if (count < 0)
+            return errno == EINTR;
+        for (size_t i = 0; i < fds.size(); ++i) {
+            if (fds[i].revents) readable.push_back(entries_[i].handler);
+        }
+    }
+
+    const int64_t now = MonotonicMillis();
+    ready_.clear();
+    for (size_t i = 0; i < readable.size(); ++i) {
+        EventHandler *const handler = readable[i];
+        const Entry *entry = Find(handler);
+        if (entry == NULL || entry->removed)
+            continue;    // Removed by a handler earlier in this round.
+        if (handler->HandleReadable(now))
+            MarkReady(handler);
+    }
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        EventHandler *const handler = entries_[i].handler;
+        if (entries_[i].removed ||
+            std::find(ready_.begin(), ready_.end(), handler) != ready_.end())
+            continue;
+        if (handler->TimeToNextDeadline(now) == 0 && handler->HandleTimeout(now))
+            MarkReady(handler);
+    }
+
+    if (!ready_.empty()) {
+        mutex_->Lock();
+        for (size_t i = 0; i < ready_.size(); ++i) {
+            if (!Find(ready_[i])->removed)
+                ready_[i]->Apply(display_);
+        }
+        display_->Send();
+        mutex_->Unlock();
+        for (size_t i = 0; i < ready_.size(); ++i) {
+            if (!Find(ready_[i])->removed)
+                ready_[i]->Applied();
+        }
+    }
+    DeleteRemoved();
+    return true;
+}
@@ -0,0 +1,104 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef FT_EVENT_LOOP_H
+#define FT_EVENT_LOOP_H
+
+#include <stdint.h>
+
+#include <vector>
+
+class CompositeFlaschenTaschen;
+
+namespace ft {
+class Mutex;
+}
+
+// A protocol front-end as seen by the EventLoop: something that receives
+// images on a file descriptor, such as the UDP socket or a client
+// connection.
+//
+// Receiving and parsing happens without the display lock; only Apply()
+// holds it.
+class EventHandler {
+public:
+    virtual ~EventHandler() {}
+
+    // The file descriptor is readable, or has an error or hang-up. Take
+    // what is there without blocking. Returns true if there is something
+    // to Apply().
+    virtual bool HandleReadable(int64_t now_ms) = 0;
+
+    // Milliseconds until the handler needs HandleTimeout() called even
+    // without input, or -1 if not. Not called in a round in which
+    // HandleReadable() already returned true, as what it has to Apply()
+    // must not be replaced; the next round follows right away then.
+    virtual int TimeToNextDeadline(int64_t now_ms) const { return -1; }
+    virtual bool HandleTimeout(int64_t now_ms) { return false; }
+
+    // Copy what was received to the display. Caller holds the display
+    // lock.
+    virtual void Apply(CompositeFlaschenTaschen *display) {}
+
+    // Called after the display was updated with what Apply() added.
+    virtual void Applied() {}
+};
+
+// Serves all protocol front-ends in one thread, with epoll (poll() where
+// that is not available).
+//
+// Each round takes the handlers that have input, in the order the kernel
+// reports them, lets them receive and parse, and then applies everything
+// in that order with one acquisition of the display lock and one Send().
+//
+// The loop owns the handlers. Only to be used from the thread calling
+// RunOnce().
+class EventLoop {
+public:
+    EventLoop(CompositeFlaschenTaschen *display, ft::Mutex *mutex);
+    ~EventLoop();   // Deletes all handlers.
+
+    // Call "handler" when "fd" is readable. Takes ownership of handler.
+    // Returns false if fd can't be watched; then the handler is deleted.
+    bool Add(int fd, EventHandler *handler);
+
+    // Stop watching the file descriptor of "handler" and delete it at the
+    // end of the current round. The handler closes its file descriptor
+    // itself in its destructor.
+    void Remove(EventHandler *handler);
+
+    // Wait for input or a handler deadline and handle it. Returns false on
+    // an unexpected error; a signal just makes it return early.
+    bool RunOnce();
+
+private:
+    struct Entry {
+        int fd;
+        EventHandler *handler;
+        bool removed;
+    };
+
+    Entry *Find(EventHandler *handler);
+    int NextTimeout(int64_t now_ms) const;
+    void MarkReady(EventHandler *handler);
+    void DeleteRemoved();
+
+    CompositeFlaschenTaschen *const display_;
+    ft::Mutex *const mutex_;
+    const int epoll_fd_;                    // -1 if we use poll().
+    std::vector<Entry> entries_;
+    std::vector<EventHandler*> ready_;      // This round, in order.
+};
+
+#endif  // FT_EVENT_LOOP_H
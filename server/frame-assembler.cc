@@ -0,0 +1,228 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "frame-assembler.h"
+
+// Incomplete frames kept per source. Senders don't have more than one or
+// two frames in flight; more means tiles got lost.
+static const size_t kMaxPendingFrames = 4;
+
+// Don't let random traffic grow the table without bounds.
+static const size_t kMaxSources = 1024;
+
+// Forget sources we haven't heard from in a while.
+static const int64_t kIdleSourceMs = 10000;
+
+// Tiles of frames up to this much older than the last frame shown are late
+// and dropped. Frame ids further back than that are a sender that started
+// over, e.g. with a new canvas on the same socket.
+static const int32_t kLateFrameWindow = 64;
+
+// Frame ids wrap around.
+static bool IsOlder(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+
+FrameAssembler::FrameAssembler(int deadline_ms, bool latest_only)
+    : deadline_ms_(deadline_ms), latest_only_(latest_only),
+      pending_frames_(0), next_prune_ms_(0),
+      dropped_tiles_(0), skipped_frames_(0) {
+}
+
+FrameAssembler::Source *FrameAssembler::Lookup(const SourceAddress &address,
+                                               int64_t now_ms) {
+    SourceMap::iterator found = sources_.find(address);
+    if (found == sources_.end()) {
+        if (sources_.size() >= kMaxSources)
+            return NULL;
+        found = sources_.insert(std::make_pair(address, Source())).first;
+    }
+    found->second.last_seen_ms = now_ms;
+    return &found->second;
+}
+
+// Not newer than what was shown last, so it would overwrite newer content.
+bool FrameAssembler::IsLate(const Source &source, uint32_t frame_id) {
+    if (!source.has_shown)
+        return false;
+    const int32_t behind = source.last_shown - frame_id;
+    return behind >= 0 && behind < kLateFrameWindow;
+}
+
+bool FrameAssembler::AddFrame(const SourceAddress &address,
+                              const ParsedPacket &frame, int64_t now_ms) {
+    Source *const source = Lookup(address, now_ms);
+    if (source == NULL)
+        return false;   // Can't keep track; show as it comes.
+    if (!source->pending.empty()) {
+        AddTile(address, frame, now_ms);
+        return true;
+    }
+    if (IsLate(*source, frame.frame_id)) {
+        ++dropped_tiles_;
+        return true;
+    }
+    source->has_shown = true;
+    source->last_shown = frame.frame_id;
+    return false;
+}
+
+void FrameAssembler::AddTile(const SourceAddress &address,
+                             const ParsedPacket &tile, int64_t now_ms) {
+    if (tile.tile_index >= tile.tile_count) {
+        ++dropped_tiles_;
+        return;
+    }
+    Source *const found = Lookup(address, now_ms);
+    if (found == NULL || IsLate(*found, tile.frame_id)) {
+        ++dropped_tiles_;
+        return;
+    }
+    Source &source = *found;
+
+    FrameList &pending = source.pending;
+    FrameList::iterator frame = pending.begin();
+    while (frame != pending.end() && IsOlder(frame->frame_id, tile.frame_id))
+        ++frame;
+    if (frame == pending.end() || frame->frame_id != tile.frame_id) {
+        frame = pending.insert(frame, PendingFrame());
+        frame->frame_id = tile.frame_id;
+        frame->delta = tile.delta;
+        frame->deadline_ms = now_ms + deadline_ms_;
+        frame->tile_count = tile.tile_count;
+        frame->tiles_received = 0;
+        frame->have_tile.resize(tile.tile_count);
+        ++pending_frames_;
+        if (pending.size() > kMaxPendingFrames) {
+            const bool is_oldest = (frame == pending.begin());
+            dropped_tiles_ += pending.front().tiles_received;
+            pending.pop_front();
+            --pending_frames_;
+            if (is_oldest) {
+                ++dropped_tiles_;
+                return;
+            }
+        }
+    }
+
+    if (tile.tile_count != frame->tile_count || frame->have_tile[tile.tile_index]) {
+        ++dropped_tiles_;   // Duplicate, or not consistent with other tiles.
+        return;
+    }
+    frame->have_tile[tile.tile_index] = true;
+    frame->tiles_received++;
+    frame->offsets.push_back(frame->data.size());
+    frame->tiles.push_back(tile);
+    frame->data.insert(frame->data.end(), tile.pixels,
+                       tile.pixels + 3 * tile.info.width * tile.info.height);
+}
+
+// Hand out the tiles of "frame", which has been moved to shown_.
+void FrameAssembler::Show(PendingFrame *frame,
+                          std::vector<ParsedPacket> *tiles) {
+    for (size_t i = 0; i < frame->tiles.size(); ++i) {
+        ParsedPacket tile = frame->tiles[i];
+        tile.pixels = frame->data.empty() ? NULL
+            : &frame->data[0] + frame->offsets[i];
+        tiles->push_back(tile);
+    }
+}
+
+void FrameAssembler::TakeReady(int64_t now_ms,
+                               std::vector<ParsedPacket> *tiles) {
+    shown_.clear();
+    if (now_ms >= next_prune_ms_) {
+        PruneIdleSources(now_ms);
+        next_prune_ms_ = now_ms + kIdleSourceMs;
+    }
+    if (pending_frames_ == 0)
+        return;
+
+    for (SourceMap::iterator it = sources_.begin(); it != sources_.end(); ++it) {
+        Source &source = it->second;
+        FrameList &pending = source.pending;
+        int complete_frames = 0;
+        int complete_full_frames = 0;
+        for (FrameList::iterator f = pending.begin(); f != pending.end(); ++f) {
+            if (f->tiles_received == f->tile_count) {
+                ++complete_frames;
+                if (!f->delta) ++complete_full_frames;
+            }
+        }
+
+        while (!pending.empty()) {
+            PendingFrame &frame = pending.front();
+            const bool complete = (frame.tiles_received == frame.tile_count);
+            if (!complete) {
+                if (complete_full_frames > 0) {
+                    // Superseded by a newer complete frame.
+                    dropped_tiles_ += frame.tiles_received;
+                    pending.pop_front();
+                    --pending_frames_;
+                    continue;
+                }
+                if (complete_frames == 0 && frame.deadline_ms > now_ms)
+                    break;  // Still waiting for tiles.
+                // Otherwise, a newer delta frame builds on what we have.
+            } else {
+                --complete_frames;
+                if (!frame.delta) --complete_full_frames;
+            }
+            if (latest_only_ && complete_full_frames > 0) {
+                // There is a newer complete frame to show instead.
+                skipped_frames_++;
+                source.has_shown = true;
+                source.last_shown = frame.frame_id;
+                pending.pop_front();
+                --pending_frames_;
+                continue;
+            }
+            source.has_shown = true;
+            source.last_shown = frame.frame_id;
+            shown_.splice(shown_.end(), pending, pending.begin());
+            --pending_frames_;
+            Show(&shown_.back(), tiles);
+        }
+    }
+}
+
+int FrameAssembler::TimeToNextDeadline(int64_t now_ms) const {
+    if (pending_frames_ == 0)
+        return -1;
+    // TakeReady() waits for the oldest frame of each source; a newer one
+    // that started earlier and passed its deadline is not shown before.
+    int64_t next = -1;
+    for (SourceMap::const_iterator it = sources_.begin();
+         it != sources_.end(); ++it) {
+        const FrameList &pending = it->second.pending;
+        if (pending.empty())
+            continue;
+        const int64_t deadline = pending.front().deadline_ms;
+        if (next < 0 || deadline < next)
+            next = deadline;
+    }
+    if (next < 0)
+        return -1;
+    return (next > now_ms) ? next - now_ms : 0;
+}
+
+void FrameAssembler::PruneIdleSources(int64_t now_ms) {
+    SourceMap::iterator it = sources_.begin();
+    while (it != sources_.end()) {
+        if (it->second.pending.empty() &&
+            it->second.last_seen_ms + kIdleSourceMs < now_ms) {
+            sources_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,140 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef FT_FRAME_ASSEMBLER_H
+#define FT_FRAME_ASSEMBLER_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include "ppm-reader.h"
+
+// Address and port a datagram came from.
+struct SourceAddress {
+    uint8_t address[16];   // IPv6; IPv4 senders are IPv4-mapped.
+    uint16_t port;
+
+    bool operator<(const SourceAddress &other) const {
+        const int c = memcmp(address, other.address, sizeof(address));
+        return c < 0 || (c == 0 && port < other.port);
+    }
+};
+
+// A datagram with its header already parsed.
+struct ParsedPacket {
+    ImageMetaInfo info;
+    const char *pixels;
+
+    // Only set for the binary protocol: the tiles a frame consists of.
+    // A tile_count of 0 or 1 means the packet is a frame by itself.
+    uint32_t frame_id;
+    uint16_t tile_index;
+    uint16_t tile_count;
+    bool delta;      // Frame only contains what changed since the last one.
+};
+
+// Collects the tiles of frames that are sent as several datagrams, so that
+// they can be shown together in one display update instead of one tile at
+// a time.
+//
+// A frame is ready once all its tiles arrived, or when its deadline passed
+// without that happening (a tile got lost); then whatever arrived is shown.
+// Incomplete frames that are older than a complete full (not delta) frame
+// from the same source are dropped: they would only overwrite newer content.
+// With "latest_only", the same is true for complete frames. Delta frames
+// build on the frames before them, so these are shown, complete or not,
+// unless a newer full frame is there.
+//
+// Not thread-safe; each receiver thread has its own. This works because the
+// kernel always hands datagrams from one source to the same socket.
+class FrameAssembler {
+public:
+    FrameAssembler(int deadline_ms, bool latest_only);
+
+    // Add tile of a multi-datagram frame received at "now_ms". The pixels
+    // are copied.
+    void AddTile(const SourceAddress &address, const ParsedPacket &tile,
+                 int64_t now_ms);
+
+    // A frame in one datagram, from a sender that uses frame ids. Returns
+    // false if the caller is to apply it right away: nothing older of its
+    // source is pending, and it is not late. It then counts as shown.
+    // Otherwise it is queued behind the pending frames of its source, like
+    // with AddTile(), or dropped if late.
+    bool AddFrame(const SourceAddress &address, const ParsedPacket &frame,
+                  int64_t now_ms);
+
+    // Append the tiles of all frames that are ready at "now_ms" to "tiles",
+    // in the order they should be applied: for each source, in the order
+    // of their frame ids. Their pixels stay valid until the next call.
+    //
+    // The frames are newer than any that AddFrame() had the caller apply
+    // directly since the last call, so they need to be applied after those.
+    void TakeReady(int64_t now_ms, std::vector<ParsedPacket> *tiles);
+
+    // Milliseconds until TakeReady() has frames to hand out because the
+    // oldest incomplete frame of a source reached its deadline, or -1 if
+    // there is none.
+    int TimeToNextDeadline(int64_t now_ms) const;
+
+    // Tiles that could not be shown: late, duplicate, or part of a frame
+    // that was superseded before it was complete.
+    int64_t dropped_tiles() const { return dropped_tiles_; }
+
+    // Complete frames not shown because a newer full frame was ready too.
+    int64_t skipped_frames() const { return skipped_frames_; }
+
+private:
+    struct PendingFrame {
+        uint32_t frame_id;
+        bool delta;
+        int64_t deadline_ms;
+        int tile_count;
+        int tiles_received;
+        std::vector<bool> have_tile;
+        std::vector<ParsedPacket> tiles;
+        std::vector<size_t> offsets;      // Where the pixels of each tile ..
+        std::vector<char> data;           // .. are in here.
+    };
+    typedef std::list<PendingFrame> FrameList;
+
+    struct Source {
+        Source() : has_shown(false), last_shown(0), last_seen_ms(0) {}
+        bool has_shown;
+        uint32_t last_shown;     // frame_id of the newest frame shown.
+        int64_t last_seen_ms;
+        FrameList pending;       // Sorted by frame_id.
+    };
+    typedef std::map<SourceAddress, Source> SourceMap;
+
+    Source *Lookup(const SourceAddress &address, int64_t now_ms);
+    static bool IsLate(const Source &source, uint32_t frame_id);
+    void Show(PendingFrame *frame, std::vector<ParsedPacket> *tiles);
+    void PruneIdleSources(int64_t now_ms);
+
+    const int deadline_ms_;
+    const bool latest_only_;
+    SourceMap sources_;
+    FrameList shown_;            // Owns the pixels handed out in TakeReady().
+    int pending_frames_;
+    int64_t next_prune_ms_;
+    int64_t dropped_tiles_;
+    int64_t skipped_frames_;
+};
+
+#endif  // FT_FRAME_ASSEMBLER_H
@@ -0,0 +1,77 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Latency probes: a sender embeds the time it sent an image in three
+// consecutive pixels; a display that finds them knows how long it took the
+// image to arrive. Time is CLOCK_MONOTONIC, so sender and display need to
+// run on the same machine (which is the case in the benchmarks).
+//
+// The probe is a marker pixel followed by two pixels with 35 bits of
+// microseconds, 7 bits per byte, and a check byte; probes that are partially
+// overwritten by other content are rejected that way. The high bit of each
+// byte is set, so that no probe pixel is black, which would be transparent
+// in layers.
+
+#ifndef FT_LATENCY_PROBE_H
+#define FT_LATENCY_PROBE_H
+
+#include <stdint.h>
+#include <time.h>
+
+static const int kLatencyProbeBytes = 9;   // Three pixels.
+static const uint64_t kLatencyProbeMask = (1ULL << 35) - 1;  // ~9.5 hours
+
+static inline uint8_t LatencyProbeCheck(const uint8_t *time_bytes) {
+    uint8_t check = 0;
+    for (int i = 0; i < 5; ++i) check = check * 31 + time_bytes[i];
+    return 0x80 | (check & 0x7f);
+}
+
+static inline uint64_t LatencyProbeNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000)
+        & kLatencyProbeMask;
+}
+
+// Write probe with the given time to "rgb".
+static inline void WriteLatencyProbe(uint64_t time_usec, uint8_t *rgb) {
+    rgb[0] = 'F'; rgb[1] = 'T'; rgb[2] = '@';
+    for (int i = 7; i >= 3; --i) {
+        rgb[i] = 0x80 | (time_usec & 0x7f);
+        time_usec >>= 7;
+    }
+    rgb[8] = LatencyProbeCheck(rgb + 3);
+}
+
+// If "rgb" starts with a probe, return true and the time it contains.
+static inline bool ReadLatencyProbe(const uint8_t *rgb, uint64_t *time_usec) {
+    if (rgb[0] != 'F' || rgb[1] != 'T' || rgb[2] != '@' ||
+        rgb[8] != LatencyProbeCheck(rgb + 3))
+        return false;
+    uint64_t result = 0;
+    for (int i = 3; i < 8; ++i) {
+        if ((rgb[i] & 0x80) == 0) return false;
+        result = (result << 7) | (rgb[i] & 0x7f);
+    }
+    *time_usec = result;
+    return true;
+}
+
+// Microseconds passed since "then", both from LatencyProbeNow().
+static inline int64_t LatencyProbeAge(uint64_t now, uint64_t then) {
+    return (now - then) & kLatencyProbeMask;
+}
+
+#endif  // FT_LATENCY_PROBE_H
@@ -15,10 +15,14 @@
 #ifndef LED_FLASCHEN_TASCHEN_H_
 #define LED_FLASCHEN_TASCHEN_H_
 
+#include "dirty-region.h"
 #include "flaschen-taschen.h"
 
-#include <vector>
+#include <set>
 #include <string>
+#include <vector>
+
+class LEDLayout;
 
 namespace spixels {
 class MultiSPI;
@@ -32,59 +36,75 @@ public:
     // tasks, but in particular to start threads (Threads must not be started
     // before becoming a daemon).
     virtual void PostDaemonInit() {}
+
+    // Like Send(), but the caller guarantees that only pixels within
+    // "changed" differ from the previous update. Displays that can do
+    // partial updates override this; the default sends everything.
+    virtual void SendPartial(const DirtyRegion &changed) { Send(); }
+
+    // Displays that can show more than 8 bit per channel return true. They
+    // then get the color corrected pixels with 16 bit per channel through
+    // BlitWide() instead of Blit(); "stride" is in bytes, as with Blit().
+    virtual bool has_wide_color() const { return false; }
+    virtual void BlitWide(int x, int y, int w, int h,
+                          const uint16_t *rgb, size_t stride) {}
+
+    // Displays that need Send() at the refresh rate even if nothing changed
+    // return true.
+    virtual bool needs_continuous_refresh() const { return false; }
 };
 
-// Column helps assembling the various columns of width 5 (the width of a crate)
-// to one big display. Since all SPI based strips are necessary upated in
-// parallel, that SPI send command is triggered within here.
+// Assembles the LED strips of all the columns of crates to one big display,
+// wired as described by the LEDLayout. Since all SPI based strips are
+// necessary upated in parallel, that SPI send command is triggered within
+// here.
 class ColumnAssembly : public ServerFlaschenTaschen {
 public:
-    ColumnAssembly(spixels::MultiSPI *spi);
+    ColumnAssembly(spixels::MultiSPI *spi, const LEDLayout &layout);
     ~ColumnAssembly();
 
-    // Add column. Takes over ownership of column.
-    // Columns have been added right to left, or, if standing
-    // behind the display: leftmost column first.
-    void AddColumn(FlaschenTaschen *taschen);
+    // Keep the pixels with more than 8 bit and show them with temporal
+    // dithering: each Send() shows the next step, so that dim colors don't
+    // collapse to a few steps. Send() then needs to be called at a high
+    // rate, by the output thread with a high --refresh-rate.
+    void EnableDithering();
 
     int width() const { return width_; }
     int height() const { return height_; }
 
     void SetPixel(int x, int y, const Color &col);
+    void Blit(int x, int y, int w, int h, const uint8_t *rgb, size_t stride);
     void Send();
 
+    bool has_wide_color() const { return dither_; }
+    void BlitWide(int x, int y, int w, int h,
+                  const uint16_t *rgb, size_t stride);
+    bool needs_continuous_refresh() const { return dither_; }
+
 private:
+    struct LEDTarget {
+        spixels::LEDStrip *strip;   // NULL if there is no LED.
+        int led;
+    };
+
     spixels::MultiSPI *const spi_;
-    std::vector<FlaschenTaschen*> columns_;
+    std::vector<spixels::LEDStrip*> strips_;
+    std::vector<LEDTarget> targets_;   // For each pixel, row by row.
     int width_;
     int height_;
-};
-
-// This represents one column. Unlike the final display,
-// x-coordinates go right-to-left, and bottom to up.
-// The final assembly will turn things around.
-class CrateColumnFlaschenTaschen : public FlaschenTaschen {
-public:
-    // Given a simple LED strip, create a column of crates that behaves
-    // the way we are snaking the strip.
-    // Takes ownership of the LED strip.
-    CrateColumnFlaschenTaschen(spixels::LEDStrip *strip);
-    ~CrateColumnFlaschenTaschen();
 
-    int width() const { return 5; }
-    int height() const { return height_; }
-
-    void SetPixel(int x, int y, const Color &col);
-    void Send() {}  // This happens in SPI sending in ColumnAssembly
-
-private:
-    spixels::LEDStrip *strip_;
-    const int height_;
+    // With dithering: the r,g,b values of each pixel as 8.8 fixed point and
+    // the error of what was shown, carried over to the next Send(). The
+    // error starts with a spatial pattern.
+    bool dither_;
+    std::vector<uint16_t> precise_;
+    std::vector<uint8_t> error_;
 };
 
 // -- FlaschenTaschen implementation using rpi-rgb-led-matrix
 namespace rgb_matrix {
 class RGBMatrix;
+class FrameCanvas;
 }
 
 class RGBMatrixFlaschenTaschen : public ServerFlaschenTaschen {
@@ -98,56 +118,113 @@ public:
     int width() const { return width_; }
     int height() const { return height_; }
 
+    // Pixels are written to an offscreen canvas, which is swapped in
+    // on the next vsync in Send(); this way, we never show half a frame.
     void SetPixel(int x, int y, const Color &col);
-    void Send() { /* update directly */ }
+    void Blit(int x, int y, int w, int h, const uint8_t *rgb, size_t stride);
+    void Send();
 
 private:
     rgb_matrix::RGBMatrix *const matrix_;
+    rgb_matrix::FrameCanvas *offscreen_;
 
     int width_;
     int height_;
 };
 
+// Shows the display with colored blocks in a terminal. Only what changed
+// since the last update is sent to the terminal, so that also large
+// displays can be shown over a slow connection, such as ssh.
 class TerminalFlaschenTaschen : public ServerFlaschenTaschen {
 public:
     TerminalFlaschenTaschen(int terminal_fd, int width, int heigh);
     virtual ~TerminalFlaschenTaschen();
-    virtual void PostDaemonInit();
 
     int width() const { return width_; }
     int height() const { return height_; }
 
     void SetPixel(int x, int y, const Color &col);
+    void Blit(int x, int y, int w, int h, const uint8_t *rgb, size_t stride);
     void Send();
 
+    // Only looks at the lines in "changed".
+    void SendPartial(const DirtyRegion &changed);
+
 protected:
-    static inline void WriteByteDecimal(char *buf, uint8_t val) {
-        buf[2] = (val % 10) + '0'; val /= 10;
-        buf[1] = (val % 10) + '0'; val /= 10;
-        buf[0] = val + '0';
-    }
+    // Geometry of a pixel on the terminal.
+    int rows_per_line_;       // Pixel rows in one line of text: 1 or 2.
+    int columns_per_pixel_;   // Character columns per pixel.
+
+private:
+    // Append what is needed to bring the cells [begin, end) of the given
+    // text line up to date.
+    void AppendLine(int line, int begin, int end);
+    void SetForeground(const Color &col);   // Unless already set.
+    void SetBackground(const Color &col);
+
+    // Frame rate and bytes sent for the frame below the display.
+    void AppendStatus(size_t frame_bytes);
 
     const int terminal_fd_;
     const int width_;
     const int height_;
-    size_t initial_offset_;
-    size_t pixel_offset_;
-    size_t fps_offset_;
     bool is_first_;
-    std::string buffer_;
     int64_t last_time_usec_;
+
+    std::vector<Color> frame_;   // Pixels we got, row by row.
+    std::vector<Color> shown_;   // What the terminal shows.
+    DirtyRegion all_;            // The whole display, for Send().
+
+    // Escape sequences of the frame being sent, and the colors last set
+    // in it.
+    std::string buffer_;
+    Color foreground_, background_;
+    bool foreground_set_, background_set_;
 };
 
-// Similar, but higher res.
+// Similar, but higher res: two pixels in one character.
 class HDTerminalFlaschenTaschen : public TerminalFlaschenTaschen {
 public:
     HDTerminalFlaschenTaschen(int terminal_fd, int width, int heigh);
-    virtual void PostDaemonInit();
+};
+
+// Display without any output, for measuring the server itself on machines
+// without hardware. Keeps the current frame in memory, counts frames and
+// pixels and prints a summary on destruction.
+class NullFlaschenTaschen : public ServerFlaschenTaschen {
+public:
+    // If "checksum_fd" is >= 0, a line with the frame number and a checksum
+    // of the frame content is written to it on each Send().
+    NullFlaschenTaschen(int width, int height, int checksum_fd);
+    virtual ~NullFlaschenTaschen();
+
+    int width() const { return width_; }
+    int height() const { return height_; }
 
     void SetPixel(int x, int y, const Color &col);
+    void Blit(int x, int y, int w, int h, const uint8_t *rgb, size_t stride);
+    void Send();
+
+    // Current frame content; r,g,b bytes, row by row.
+    const uint8_t *frame() const { return &frame_[0]; }
+
+    // Look for latency probes (see latency-probe.h) in each frame sent and
+    // add latency percentiles to the summary.
+    void set_measure_latency(bool on) { measure_latency_ = on; }
 
 private:
-    size_t lower_row_pixel_offset_;
+    void CollectLatencyProbes();
+
+    const int width_;
+    const int height_;
+    const int checksum_fd_;
+    std::vector<uint8_t> frame_;
+    int64_t frames_;
+    int64_t pixels_;
+    int64_t start_time_usec_;  // First pixel received.
+    bool measure_latency_;
+    std::vector<int64_t> latencies_usec_;
+    std::set<uint64_t> seen_probes_;  // Content stays until overwritten.
 };
 
 #endif // LED_FLASCHEN_TASCHEN_H_
@@ -0,0 +1,234 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "led-layout.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+// Number of SPI connectors on the spixels board.
+static const int kMaxConnector = 16;
+
+static const char kDefaultLayout[] =
+    "# Crate wiring as seen from the back. Wiring is always happening on\n"
+    "# the left of the crate; the previous crate enters at the bottom left,\n"
+    "# the next crate is on top.\n"
+    "crate 5 5\n"
+    "24 23 22 21 20\n"
+    " 3  4 11 12 19\n"
+    " 2  5 10 13 18\n"
+    " 1  6  9 14 17\n"
+    " 0  7  8 15 16\n"
+    "\n"
+    "# Looking from the back of the display: leftmost column first.\n"
+    "column P8 7\n"
+    "column P7 7\n"
+    "column P6 7\n"
+    "column P5 7\n"
+    "column P13 7  # Center column. Connected to front part\n"
+    "column P4 7   # Rest: continue on the back part\n"
+    "column P3 7\n"
+    "column P2 7\n"
+    "column P1 7\n";
+
+LEDLayout::LEDLayout(int crate_width, int crate_height,
+                     const std::vector<int> &crate_mapping,
+                     const std::vector<int> &column_crates,
+                     const std::vector<int> &column_connectors)
+    : width_(crate_width * column_crates.size()), height_(0) {
+    for (size_t c = 0; c < column_crates.size(); ++c) {
+        Strip strip;
+        strip.connector = column_connectors[c];
+        strip.length = column_crates[c] * crate_width * crate_height;
+        strips_.push_back(strip);
+        height_ = std::max(height_, column_crates[c] * crate_height);
+    }
+
+    // The first column is the leftmost seen from the back, so the rightmost
+    // seen from the front; everything is mirrored. Strips start at the
+    // bottom.
+    const int crate_leds = crate_width * crate_height;
+    const int columns = column_crates.size();
+    addresses_.resize(width_ * height_);
+    for (int y = 0; y < height_; ++y) {
+        const int from_bottom = height_ - y - 1;
+        const int crate = from_bottom / crate_height;
+        const int crate_row = crate_height - 1 - from_bottom % crate_height;
+        for (int x = 0; x < width_; ++x) {
+            const int column = columns - 1 - x / crate_width;
+            const int crate_col = crate_width - 1 - x % crate_width;
+            Address &address = addresses_[y * width_ + x];
+            if (crate >= column_crates[column]) {
+                address.strip = -1;    // Column not that high.
+                address.led = 0;
+                continue;
+            }
+            address.strip = column;
+            address.led = crate * crate_leds
+                + crate_mapping[crate_row * crate_width + crate_col];
+        }
+    }
+}
+
+LEDLayout *LEDLayout::CreateDefault() {
+    std::string error;
+    LEDLayout *result = Parse(kDefaultLayout, &error);
+    if (result == NULL) {
+        fprintf(stderr, "Default layout: %s\n", error.c_str());
+        abort();
+    }
+    return result;
+}
+
+LEDLayout *LEDLayout::Load(const char *filename, std::string *error) {
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        *error = std::string(filename) + ": " + strerror(errno);
+        return NULL;
+    }
+    std::string description;
+    char buffer[4096];
+    size_t r;
+    while ((r = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        description.append(buffer, r);
+    }
+    fclose(f);
+    LEDLayout *result = Parse(description, error);
+    if (result == NULL) {
+        *error = std::string(filename) + ": " + *error;
+    }
+    return result;
+}
+
+// Split line into whitespace separated words, up to a '#' comment.
+static std::vector<std::string> SplitWords(const std::string &line) {
+    std::vector<std::string> words;
+    const size_t end = std::min(line.find('#'), line.size());
+    size_t pos = 0;
+    for (;;) {
+        pos = line.find_first_not_of(" \t\r", pos);
+        if (pos >= end) break;
+        const size_t word_end = std::min(line.find_first_of(" \t\r", pos), end);
+        words.push_back(line.substr(pos, word_end - pos));
+        pos = word_end;
+    }
+    return words;
+}
+
+// Parse non-negative number. Returns -1 if it is not one.
+static int ParseNumber(const std::string &word) {
+    char *end;
+    const long value = strtol(word.c_str(), &end, 10);
+    if (word.empty() || *end != '\0' || value < 0 || value > 65535)
+        return -1;
+    return value;
+}
+
+LEDLayout *LEDLayout::Parse(const std::string &description,
+                            std::string *error) {
+    int crate_width = 0, crate_height = 0;
+    std::vector<int> mapping;
+    std::vector<int> column_crates;
+    std::vector<int> column_connectors;
+
+    int line_no = 0;
+    size_t pos = 0;
+    char msg[256];
+    while (pos < description.size()) {
+        size_t eol = description.find('\n', pos);
+        if (eol == std::string::npos) eol = description.size();
+        const std::vector<std::string> words
+            = SplitWords(description.substr(pos, eol - pos));
+        pos = eol + 1;
+        ++line_no;
+        if (words.empty())
+            continue;
+
+        if (crate_width > 0 && (int)mapping.size() < crate_width * crate_height) {
+            // A row of the crate mapping.
+            if ((int)words.size() != crate_width) {
+                snprintf(msg, sizeof(msg), "line %d: expected %d LED indices",
+                         line_no, crate_width);
+                *error = msg;
+                return NULL;
+            }
+            for (size_t i = 0; i < words.size(); ++i) {
+                const int led = ParseNumber(words[i]);
+                if (led < 0 || led >= crate_width * crate_height
+                    || std::find(mapping.begin(), mapping.end(), led)
+                    != mapping.end()) {
+                    snprintf(msg, sizeof(msg),
+                             "line %d: '%s' is not a valid LED index or used "
+                             "twice", line_no, words[i].c_str());
+                    *error = msg;
+                    return NULL;
+                }
+                mapping.push_back(led);
+            }
+        } else if (words[0] == "crate" && words.size() == 3
+                   && crate_width == 0) {
+            crate_width = ParseNumber(words[1]);
+            crate_height = ParseNumber(words[2]);
+            if (crate_width < 1 || crate_width > 64
+                || crate_height < 1 || crate_height > 64) {
+                snprintf(msg, sizeof(msg), "line %d: invalid crate size",
+                         line_no);
+                *error = msg;
+                return NULL;
+            }
+        } else if (words[0] == "column" && words.size() == 3) {
+            const int connector = (words[1].size() > 1 && words[1][0] == 'P')
+                ? ParseNumber(words[1].substr(1)) : -1;
+            const int crates = ParseNumber(words[2]);
+            if (connector < 1 || connector > kMaxConnector
+                || std::find(column_connectors.begin(), column_connectors.end(),
+                             connector) != column_connectors.end()
+                || crates < 1) {
+                snprintf(msg, sizeof(msg),
+                         "line %d: expected 'column P<1..%d> <crates>' with "
+                         "each connector used once", line_no, kMaxConnector);
+                *error = msg;
+                return NULL;
+            }
+            column_connectors.push_back(connector);
+            column_crates.push_back(crates);
+        } else {
+            snprintf(msg, sizeof(msg), "line %d: expected 'crate <width> "
+                     "<height>' followed by its rows, or 'column'", line_no);
+            *error = msg;
+            return NULL;
+        }
+    }
+
+    if (crate_width == 0 || (int)mapping.size() < crate_width * crate_height) {
+        *error = "missing or incomplete crate description";
+        return NULL;
+    }
+    if (column_crates.empty()) {
+        *error = "no columns";
+        return NULL;
+    }
+    for (size_t i = 0; i < column_crates.size(); ++i) {
+        if (column_crates[i] * crate_width * crate_height > 65535) {
+            *error = "column with more than 65535 LEDs";
+            return NULL;
+        }
+    }
+    return new LEDLayout(crate_width, crate_height, mapping,
+                         column_crates, column_connectors);
+}
@@ -0,0 +1,91 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef FT_LED_LAYOUT_H
+#define FT_LED_LAYOUT_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Where each pixel of the display is on the LED strips.
+//
+// The display is made of columns of crates stacked on top of each other;
+// each column has its own strip, that enters at the bottom crate and snakes
+// through each crate the same way. This is described in a text file:
+//
+//   # Crate wiring as seen from the back: the LED index at each position,
+//   # top row first.
+//   crate 5 5
+//   24 23 22 21 20
+//    3  4 11 12 19
+//    2  5 10 13 18
+//    1  6  9 14 17
+//    0  7  8 15 16
+//
+//   # One line per column, leftmost as seen from the back first:
+//   # SPI connector the strip is on and number of crates.
+//   column P8 7
+//   column P7 7
+//   ...
+//
+// From that, a table with the strip and LED of each (x, y) is computed
+// once, so that updating the display does not need any arithmetic.
+class LEDLayout {
+public:
+    struct Address {
+        int16_t strip;     // Index into strips(), -1 if there is no LED.
+        uint16_t led;      // Position on the strip.
+    };
+
+    struct Strip {
+        int connector;     // Number n of the SPI connector Pn.
+        int length;        // LEDs.
+    };
+
+    // The wiring of the Noisebridge installation.
+    static LEDLayout *CreateDefault();
+
+    // Read layout description from file. Returns NULL and sets "error"
+    // if it can't be read or is not valid.
+    static LEDLayout *Load(const char *filename, std::string *error);
+
+    // Like Load(), but from the description itself.
+    static LEDLayout *Parse(const std::string &description,
+                            std::string *error);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    const std::vector<Strip> &strips() const { return strips_; }
+
+    // Row by row, top left first, as seen from the front.
+    const Address *addresses() const { return &addresses_[0]; }
+    const Address &address(int x, int y) const {
+        return addresses_[y * width_ + x];
+    }
+
+private:
+    LEDLayout(int crate_width, int crate_height,
+              const std::vector<int> &crate_mapping,
+              const std::vector<int> &column_crates,
+              const std::vector<int> &column_connectors);
+
+    int width_;
+    int height_;
+    std::vector<Strip> strips_;
+    std::vector<Address> addresses_;
+};
+
+#endif  // FT_LED_LAYOUT_H
@@ -0,0 +1,304 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Receives frames from producers on the same machine through shared memory.
+// See local-protocol.h for how it works.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "composite-flaschen-taschen.h"
+#include "event-loop.h"
+#include "local-protocol.h"
+#include "servers.h"
+
+// Connections we serve at the same time.
+static const int kMaxClients = 16;
+
+// Frame messages taken from one client per round; all of them are applied
+// with one lock acquisition and one Send().
+static const int kMaxFramesPerRound = 16;
+
+namespace {
+// A connected client and its shared memory.
+class LocalClient : public EventHandler {
+public:
+    LocalClient(int fd, EventLoop *loop, int *client_count)
+        : fd_(fd), loop_(loop), client_count_(client_count),
+          memory_(NULL), memory_size_(0), width_(0), height_(0),
+          slot_count_(0), brightness_(-1) {
+        ++*client_count_;
+    }
+
+    virtual ~LocalClient() {
+        if (memory_) munmap((void*) memory_, memory_size_);
+        close(fd_);
+        --*client_count_;
+    }
+
+    virtual bool HandleReadable(int64_t now_ms) {
+        if (memory_ == NULL) {
+            ReceiveHello();
+            return brightness_ >= 0;
+        }
+        frames_.clear();
+        for (int i = 0; i < kMaxFramesPerRound; ++i) {
+            LocalFrameMessage msg;
+            const ssize_t len = recv(fd_, &msg, sizeof(msg), MSG_DONTWAIT);
+            if (len < 0 && errno == EAGAIN)
+                break;
+            if (len != (ssize_t)sizeof(msg) || msg.slot >= slot_count_) {
+                loop_->Remove(this);   // Hung up or garbage.
+                return false;
+            }
+            frames_.push_back(msg);
+        }
+        return !frames_.empty();
+    }
+
+    virtual void Apply(CompositeFlaschenTaschen *display) {
+        if (brightness_ >= 0) {
+            display->SetBrightness(brightness_);
+            return;
+        }
+        const size_t frame_size = 3 * width_ * height_;
+        for (size_t i = 0; i < frames_.size(); ++i) {
+            const LocalFrameMessage &msg = frames_[i];
+            display->SetLayer(msg.layer);
+            display->Blit(msg.offset_x, msg.offset_y, width_, height_,
+                          memory_ + msg.slot * frame_size, 3 * width_);
+        }
+        display->SetLayer(0);  // Back to sane default.
+    }
+
+    // Done with the slots; the client can draw into them again.
+    virtual void Applied() {
+        if (brightness_ >= 0) {
+            LocalBrightness reply;
+            memset(&reply, 0, sizeof(reply));
+            reply.magic = kLocalBrightnessMagic;
+            reply.percent = brightness_;
+            send(fd_, &reply, sizeof(reply), MSG_NOSIGNAL | MSG_DONTWAIT);
+            loop_->Remove(this);   // That is all this client wants.
+            return;
+        }
+        for (size_t i = 0; i < frames_.size(); ++i) {
+            const uint16_t slot = frames_[i].slot;
+            if (send(fd_, &slot, sizeof(slot),
+                     MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+                loop_->Remove(this);
+                return;
+            }
+        }
+    }
+
+private:
+    // The socket is open to all local users, so anyone can show a layer.
+    // The brightness is for the whole installation though; only root and
+    // the user the server runs as may change it.
+    bool MayChangeBrightness() const {
+#ifdef SO_PEERCRED
+        struct ucred peer;
+        socklen_t len = sizeof(peer);
+        if (getsockopt(fd_, SOL_SOCKET, SO_PEERCRED, &peer, &len) != 0)
+            return false;
+        return peer.uid == 0 || peer.uid == geteuid();
+#else
+        return false;
+#endif
+    }
+
+    // The first message: canvas size and the shared memory, or a
+    // brightness change.
+    void ReceiveHello() {
+        union {
+            LocalHello hello;
+            LocalBrightness brightness;
+        } first;
+        const LocalHello &hello = first.hello;
+        struct iovec iov;
+        iov.iov_base = &first;
+        iov.iov_len = sizeof(first);
+        union {
+            char buf[CMSG_SPACE(sizeof(int))];
+            struct cmsghdr align;
+        } control;
+        memset(&control, 0, sizeof(control));
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        const ssize_t len = recvmsg(fd_, &msg,
+                                    MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (len < 0 && errno == EAGAIN)
+            return;
+
+        int mem_fd = -1;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+            && cmsg->cmsg_type == SCM_RIGHTS
+            && cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+            memcpy(&mem_fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+        if (len == (ssize_t)sizeof(LocalBrightness) && mem_fd < 0
+            && first.brightness.magic == kLocalBrightnessMagic
+            && first.brightness.percent <= 100) {
+            if (!MayChangeBrightness()) {
+                loop_->Remove(this);
+                return;
+            }
+            brightness_ = first.brightness.percent;
+            return;
+        }
+        if (len != (ssize_t)sizeof(hello) || mem_fd < 0
+            || hello.magic != kLocalProtocolMagic
+            || hello.width == 0 || hello.height == 0
+            || hello.slot_count == 0 || hello.slot_count > kLocalMaxSlots) {
+            if (mem_fd >= 0) close(mem_fd);
+            loop_->Remove(this);
+            return;
+        }
+
+        // The client must not be able to shrink the memory while we read
+        // it; that would crash us with SIGBUS. Seals can't be removed once
+        // set, so checking now is enough.
+        const size_t size = LocalSharedMemorySize(hello.width, hello.height,
+                                                  hello.slot_count);
+        struct stat st;
+        void *mem = MAP_FAILED;
+#ifdef F_GET_SEALS
+        const int seals = fcntl(mem_fd, F_GET_SEALS);
+        if (seals >= 0 && (seals & F_SEAL_SHRINK)
+            && fstat(mem_fd, &st) == 0 && (size_t)st.st_size >= size) {
+            mem = mmap(NULL, size, PROT_READ, MAP_SHARED, mem_fd, 0);
+        }
+#endif
+        close(mem_fd);
+        if (mem == MAP_FAILED) {
+            loop_->Remove(this);
+            return;
+        }
+        memory_ = (const uint8_t*) mem;
+        memory_size_ = size;
+        width_ = hello.width;
+        height_ = hello.height;
+        slot_count_ = hello.slot_count;
+    }
+
+    const int fd_;
+    EventLoop *const loop_;
+    int *const client_count_;
+    const uint8_t *memory_;   // NULL until the hello arrived.
+    size_t memory_size_;
+    int width_;
+    int height_;
+    int slot_count_;
+    int brightness_;          // Brightness to set, or -1 if a frame client.
+    std::vector<LocalFrameMessage> frames_;   // Received this round.
+};
+
+// Accepts connections on the listening socket.
+class LocalListener : public EventHandler {
+public:
+    LocalListener(int fd, const std::string &path, EventLoop *loop)
+        : fd_(fd), path_(path), loop_(loop), client_count_(0) {}
+
+    virtual ~LocalListener() {
+        close(fd_);
+        // Fails if we dropped privileges since creating it; then the next
+        // start removes it.
+        unlink(path_.c_str());
+    }
+
+    virtual bool HandleReadable(int64_t now_ms) {
+        const int fd = accept(fd_, NULL, NULL);
+        if (fd < 0)
+            return false;
+        if (client_count_ >= kMaxClients) {
+            close(fd);
+            return false;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        loop_->Add(fd, new LocalClient(fd, loop_, &client_count_));
+        return false;
+    }
+
+private:
+    const int fd_;
+    const std::string path_;
+    EventLoop *const loop_;
+    int client_count_;
+};
+}  // namespace
+
+// public interface
+static int server_socket = -1;
+static std::string server_path;
+
+bool local_server_init(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Local socket path too long: %s\n", path);
+        return false;
+    }
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    // A socket left behind by a previous run that wasn't shut down cleanly.
+    // Anything else we don't touch.
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    int s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (s < 0) {
+        perror("Creating local socket");
+        return false;
+    }
+    if (bind(s, (struct sockaddr *) &addr, sizeof(addr)) < 0
+        || listen(s, kMaxClients) < 0) {
+        fprintf(stderr, "Listening on local socket %s: %s\n",
+                path, strerror(errno));
+        close(s);
+        return false;
+    }
+    // Like the UDP port, anyone on this machine can send images.
+    chmod(path, 0666);
+    server_socket = s;
+    server_path = path;
+    fprintf(stderr, "Local server: ready to listen on %s\n", path);
+    return true;
+}
+
+void local_server_start(EventLoop *event_loop) {
+    if (server_socket < 0)
+        return;
+    event_loop->Add(server_socket,
+                    new LocalListener(server_socket, server_path, event_loop));
+}
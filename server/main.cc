@@ -15,6 +15,7 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <grp.h>
 #include <pwd.h>
@@ -29,13 +30,15 @@
 #include <string>
 
 #include "composite-flaschen-taschen.h"
+#include "event-loop.h"
 #include "ft-thread.h"
 #include "led-flaschen-taschen.h"
+#include "local-protocol.h"
 #include "servers.h"
 
 #if FT_BACKEND == 0
 #  include "multi-spi.h"
-#  include "led-strip.h"
+#  include "led-layout.h"
 #endif
 
 #if FT_BACKEND == 1
@@ -83,8 +86,39 @@ static int usage(const char *progname) {
             "\t--hd-terminal       : Make terminal with higher resolution.\n"
 #else
             "\t-d                  : Become daemon\n"
+#endif
+#if FT_BACKEND == 0
+            "\t--led-layout <file> : Wiring of crates and strips; see led-layout.h\n"
+            "\t                      (Default: the Noisebridge installation)\n"
+            "\t--dither            : Temporal dithering for smooth dim colors; best\n"
+            "\t                      with a high --refresh-rate, e.g. 200\n"
 #endif
             "\t--layer-timeout <sec>: Layer timeout: clearing after non-activity (Default: 15)\n"
+            "\t--refresh-rate <hz> : Max display update rate; 0 updates synchronously\n"
+            "\t                      with each received batch (Default: 60)\n"
+            "\t--gamma <gamma>     : Gamma correction of the output (Default: 1.0)\n"
+            "\t--color-balance <r>,<g>,<b>: Scale color channels, in percent\n"
+            "\t                      (Default: 100,100,100)\n"
+            "\t--brightness <percent>: Output brightness; can be changed while\n"
+            "\t                      running with set-brightness (Default: 100)\n"
+            "\t--udp-batch <n>     : Max UDP packets applied per display update (Default: 16)\n"
+            "\t--udp-batch-wait <ms>: Max time to wait for a batch to fill (Default: 0)\n"
+            "\t--udp-threads <n>   : Number of UDP receiver threads (Default: 1)\n"
+            "\t--udp-cpu-mask <mask>: Pin receiver threads to these CPUs, e.g. 0x6\n"
+            "\t--udp-frame-deadline <ms>: Max wait for missing tiles of a frame;\n"
+            "\t                      0 shows tiles as they arrive (Default: 20)\n"
+            "\t--udp-source-packets <n>: Max packets/s per sending host (Default: unlimited)\n"
+            "\t--udp-source-bytes <n>: Max bytes/s per sending host (Default: unlimited)\n"
+            "\t--udp-coalesce      : When behind, skip images superseded by newer ones\n"
+            "\t--local-socket <path>: Also accept frames from local clients through\n"
+            "\t                      shared memory on this socket (e.g. " DEFAULT_FT_LOCAL_SOCKET ")\n"
+            "\t--opc-port <port>   : Also accept Open Pixel Control on this TCP port\n"
+            "\t                      (usually 7890)\n"
+#if FT_BACKEND == 3
+            "\t--frame-checksums <file>: Write a checksum of each frame to file\n"
+            "\t                      ('-' for stdout)\n"
+            "\t--latency-probes    : Measure latency using probes sent by ft-loadgen\n"
+#endif
             );
 #if FT_BACKEND == 1
     rgb_matrix::PrintMatrixFlags(stderr);
@@ -96,12 +130,27 @@ int main(int argc, char *argv[]) {
     int width = 45;
     int height = 35;
     int layer_timeout = 15;
+    int refresh_rate = 60;
+    float gamma = 1.0;
+    int balance[3] = { 100, 100, 100 };
+    int brightness = 100;
+    UDPServerOptions udp_options;
+    const char *local_socket = NULL;
+    int opc_port = 0;
 #if FT_BACKEND != 2
     bool as_daemon = false;
 #endif
+#if FT_BACKEND == 0
+    const char *layout_file = NULL;
+    bool dither = false;
+#endif
 #if FT_BACKEND == 2
     bool hd_terminal = false;
 #endif
+#if FT_BACKEND == 3
+    const char *checksum_file = NULL;
+    bool latency_probes = false;
+#endif
 
 #if FT_BACKEND == 1
     width = -1;    // Use size from matrix unless explicitly chosen.
@@ -122,6 +171,24 @@ int main(int argc, char *argv[]) {
     enum LongOptionsOnly {
         OPT_LAYER_TIMEOUT = 1002,
         OPT_HD_TERMINAL = 1003,
+        OPT_UDP_BATCH = 1004,
+        OPT_UDP_BATCH_WAIT = 1005,
+        OPT_UDP_THREADS = 1006,
+        OPT_UDP_CPU_MASK = 1007,
+        OPT_REFRESH_RATE = 1008,
+        OPT_FRAME_CHECKSUMS = 1009,
+        OPT_LATENCY_PROBES = 1010,
+        OPT_UDP_FRAME_DEADLINE = 1011,
+        OPT_UDP_SOURCE_PACKETS = 1012,
+        OPT_UDP_SOURCE_BYTES = 1013,
+        OPT_UDP_COALESCE = 1014,
+        OPT_LOCAL_SOCKET = 1015,
+        OPT_OPC_PORT = 1016,
+        OPT_LED_LAYOUT = 1017,
+        OPT_GAMMA = 1018,
+        OPT_COLOR_BALANCE = 1019,
+        OPT_BRIGHTNESS = 1020,
+        OPT_DITHER = 1021,
     };
 
     static struct option long_options[] = {
@@ -130,8 +197,30 @@ int main(int argc, char *argv[]) {
         { "daemon",             no_argument,       NULL, 'd'},
 #endif
         { "layer-timeout",      required_argument, NULL,  OPT_LAYER_TIMEOUT },
+        { "refresh-rate",       required_argument, NULL,  OPT_REFRESH_RATE },
+        { "gamma",              required_argument, NULL,  OPT_GAMMA },
+        { "color-balance",      required_argument, NULL,  OPT_COLOR_BALANCE },
+        { "brightness",         required_argument, NULL,  OPT_BRIGHTNESS },
+        { "udp-batch",          required_argument, NULL,  OPT_UDP_BATCH },
+        { "udp-batch-wait",     required_argument, NULL,  OPT_UDP_BATCH_WAIT },
+        { "udp-threads",        required_argument, NULL,  OPT_UDP_THREADS },
+        { "udp-cpu-mask",       required_argument, NULL,  OPT_UDP_CPU_MASK },
+        { "udp-frame-deadline", required_argument, NULL,  OPT_UDP_FRAME_DEADLINE },
+        { "udp-source-packets", required_argument, NULL,  OPT_UDP_SOURCE_PACKETS },
+        { "udp-source-bytes",   required_argument, NULL,  OPT_UDP_SOURCE_BYTES },
+        { "udp-coalesce",       no_argument,       NULL,  OPT_UDP_COALESCE },
+        { "local-socket",       required_argument, NULL,  OPT_LOCAL_SOCKET },
+        { "opc-port",           required_argument, NULL,  OPT_OPC_PORT },
+#if FT_BACKEND == 0
+        { "led-layout",         required_argument, NULL,  OPT_LED_LAYOUT },
+        { "dither",             no_argument,       NULL,  OPT_DITHER },
+#endif
 #if FT_BACKEND == 2
         { "hd-terminal",        no_argument,       NULL,  OPT_HD_TERMINAL },
+#endif
+#if FT_BACKEND == 3
+        { "frame-checksums",    required_argument, NULL,  OPT_FRAME_CHECKSUMS },
+        { "latency-probes",     no_argument,       NULL,  OPT_LATENCY_PROBES },
 #endif
         { 0,                    0,                 0,    0  },
     };
@@ -153,10 +242,76 @@ int main(int argc, char *argv[]) {
         case OPT_LAYER_TIMEOUT:
             layer_timeout = atoi(optarg);
             break;
+        case OPT_REFRESH_RATE:
+            refresh_rate = atoi(optarg);
+            break;
+        case OPT_GAMMA:
+            gamma = atof(optarg);
+            if (gamma <= 0) {
+                fprintf(stderr, "Invalid gamma '%s'\n", optarg);
+                return usage(argv[0]);
+            }
+            break;
+        case OPT_COLOR_BALANCE:
+            if (sscanf(optarg, "%d,%d,%d",
+                       &balance[0], &balance[1], &balance[2]) != 3) {
+                fprintf(stderr, "Invalid color balance '%s'\n", optarg);
+                return usage(argv[0]);
+            }
+            break;
+        case OPT_BRIGHTNESS:
+            brightness = atoi(optarg);
+            break;
+        case OPT_UDP_BATCH:
+            udp_options.batch_size = atoi(optarg);
+            break;
+        case OPT_UDP_BATCH_WAIT:
+            udp_options.batch_wait_ms = atoi(optarg);
+            break;
+        case OPT_UDP_THREADS:
+            udp_options.receiver_threads = atoi(optarg);
+            break;
+        case OPT_UDP_CPU_MASK:
+            udp_options.receiver_cpu_mask = strtoul(optarg, NULL, 0);
+            break;
+        case OPT_UDP_FRAME_DEADLINE:
+            udp_options.frame_deadline_ms = atoi(optarg);
+            break;
+        case OPT_UDP_SOURCE_PACKETS:
+            udp_options.source_packets_per_second = atoi(optarg);
+            break;
+        case OPT_UDP_SOURCE_BYTES:
+            udp_options.source_bytes_per_second = atoi(optarg);
+            break;
+        case OPT_UDP_COALESCE:
+            udp_options.coalesce = true;
+            break;
+        case OPT_LOCAL_SOCKET:
+            local_socket = optarg;
+            break;
+        case OPT_OPC_PORT:
+            opc_port = atoi(optarg);
+            break;
+#if FT_BACKEND == 0
+        case OPT_LED_LAYOUT:
+            layout_file = optarg;
+            break;
+        case OPT_DITHER:
+            dither = true;
+            break;
+#endif
 #if FT_BACKEND == 2
         case OPT_HD_TERMINAL:
             hd_terminal = true;
             break;
+#endif
+#if FT_BACKEND == 3
+        case OPT_FRAME_CHECKSUMS:
+            checksum_file = optarg;
+            break;
+        case OPT_LATENCY_PROBES:
+            latency_probes = true;
+            break;
 #endif
         default:
             return usage(argv[0]);
@@ -168,29 +323,28 @@ int main(int argc, char *argv[]) {
     }
 
 #if FT_BACKEND == 0
-    using spixels::MultiSPI;
-    using spixels::CreateWS2801Strip;
-    static const int kLedsPerCol = 7 * 25;
-    MultiSPI *const spi = spixels::CreateDMAMultiSPI();
-    ColumnAssembly *display = new ColumnAssembly(spi);
-
-#define MAKE_COLUMN(port) new CrateColumnFlaschenTaschen(CreateWS2801Strip(spi, port, kLedsPerCol))
-
-    // Looking from the back of the display: leftmost column first.
-    display->AddColumn(MAKE_COLUMN(MultiSPI::SPI_P8));
-    display->AddColumn(MAKE_COLUMN(MultiSPI::SPI_P7));
-    display->AddColumn(MAKE_COLUMN(MultiSPI::SPI_P6));
-    display->AddColumn(MAKE_COLUMN(MultiSPI::SPI_P5));
-
-    // Center column. Connected to front part
-    display->AddColumn(MAKE_COLUMN(MultiSPI::SPI_P13));
-
-    // Rest: continue on the back part
-    display->AddColumn(MAKE_COLUMN(MultiSPI::SPI_P4));
-    display->AddColumn(MAKE_COLUMN(MultiSPI::SPI_P3));
-    display->AddColumn(MAKE_COLUMN(MultiSPI::SPI_P2));
-    display->AddColumn(MAKE_COLUMN(MultiSPI::SPI_P1));
-#undef MAKE_COLUMN
+    LEDLayout *layout;
+    if (layout_file) {
+        std::string error;
+        layout = LEDLayout::Load(layout_file, &error);
+        if (layout == NULL) {
+            fprintf(stderr, "Invalid layout: %s\n", error.c_str());
+            return 1;
+        }
+    } else {
+        layout = LEDLayout::CreateDefault();
+    }
+    spixels::MultiSPI *const spi = spixels::CreateDMAMultiSPI();
+    ColumnAssembly *display = new ColumnAssembly(spi, *layout);
+    delete layout;
+    if (dither) {
+        if (refresh_rate <= 0) {
+            fprintf(stderr, "--dither needs the output thread; "
+                    "--refresh-rate must be > 0\n");
+            return 1;
+        }
+        display->EnableDithering();
+    }
 #elif FT_BACKEND == 1
     ServerFlaschenTaschen *display
         = new RGBMatrixFlaschenTaschen(
@@ -201,11 +355,31 @@ int main(int argc, char *argv[]) {
         hd_terminal
         ? new HDTerminalFlaschenTaschen(STDOUT_FILENO, width, height)
         : new TerminalFlaschenTaschen(STDOUT_FILENO, width, height);
+#elif FT_BACKEND == 3
+    int checksum_fd = -1;
+    if (checksum_file != NULL) {
+        checksum_fd = (strcmp(checksum_file, "-") == 0)
+            ? STDOUT_FILENO
+            : open(checksum_file, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if (checksum_fd < 0) {
+            perror(checksum_file);
+            return 1;
+        }
+    }
+    NullFlaschenTaschen *display
+        = new NullFlaschenTaschen(width, height, checksum_fd);
+    display->set_measure_latency(latency_probes);
 #endif
 
     // Start all the services and report problems (such as sockets already
     // bound to) before we become a daemon
-    if (!udp_server_init(1337)) {
+    if (!udp_server_init(1337, udp_options)) {
+        return 1;
+    }
+    if (local_socket && !local_server_init(local_socket)) {
+        return 1;
+    }
+    if (opc_port > 0 && !opc_server_init(opc_port)) {
         return 1;
     }
 
@@ -227,8 +401,21 @@ int main(int argc, char *argv[]) {
 
     // The display we expose to the user provides composite layering which can
     // be used by the UDP server.
-    CompositeFlaschenTaschen layered_display(display, 16);
-    layered_display.StartLayerGarbageCollection(&mutex, layer_timeout);
+    CompositeFlaschenTaschen *layered_display
+        = new CompositeFlaschenTaschen(display, 16);
+    ColorCorrection correction(gamma, balance[0], balance[1], balance[2]);
+    correction.SetBrightness(brightness);
+    layered_display->SetColorCorrection(correction);
+    layered_display->StartLayerGarbageCollection(&mutex, layer_timeout);
+    if (refresh_rate > 0) {
+        // Decouple the display update from receiving.
+        layered_display->StartOutputThread(refresh_rate);
+    }
+
+    // All front-ends are served in this thread by one event loop.
+    EventLoop *event_loop = new EventLoop(layered_display, &mutex);
+    local_server_start(event_loop);
+    opc_server_start(event_loop, layered_display);
 
 #ifndef __APPLE__
     // After hardware is set up, all servers are listening and all
@@ -238,6 +425,9 @@ int main(int argc, char *argv[]) {
         return 1;
 #endif
 
-    udp_server_run_blocking(&layered_display, &mutex);  // last server blocks.
+    udp_server_run_blocking(layered_display, &mutex,
+                            udp_options, event_loop);  // last server blocks.
+    delete event_loop;
+    delete layered_display;  // Stops threads still accessing the display.
     delete display;
 }
@@ -0,0 +1,127 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "led-flaschen-taschen.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "latency-probe.h"
+
+static int64_t CurrentTimeMicros() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// FNV-1a: simple, and good enough to tell frames apart.
+static uint64_t Checksum(const uint8_t *data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+NullFlaschenTaschen::NullFlaschenTaschen(int width, int height,
+                                         int checksum_fd)
+    : width_(width), height_(height), checksum_fd_(checksum_fd),
+      frame_(3 * width * height), frames_(0), pixels_(0),
+      start_time_usec_(-1), measure_latency_(false) {
+}
+
+NullFlaschenTaschen::~NullFlaschenTaschen() {
+    const double duration = (start_time_usec_ < 0)
+        ? 0 : (CurrentTimeMicros() - start_time_usec_) / 1e6;
+    fprintf(stderr, "null display: %lld frames, %lld pixels in %.3fs",
+            (long long)frames_, (long long)pixels_, duration);
+    if (duration > 0) {
+        fprintf(stderr, " (%.1f frames/s, %.3f Mpixel/s)",
+                frames_ / duration, pixels_ / duration / 1e6);
+    }
+    fprintf(stderr, "\n");
+    if (measure_latency_) {
+        std::vector<int64_t> &l = latencies_usec_;
+        std::sort(l.begin(), l.end());
+        fprintf(stderr, "null display: %d latency probes", (int)l.size());
+        if (!l.empty()) {
+            fprintf(stderr, "; p50 %.3fms, p99 %.3fms, max %.3fms",
+                    l[l.size() / 2] / 1e3, l[l.size() * 99 / 100] / 1e3,
+                    l.back() / 1e3);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+void NullFlaschenTaschen::SetPixel(int x, int y, const Color &col) {
+    if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
+    if (start_time_usec_ < 0) start_time_usec_ = CurrentTimeMicros();
+    uint8_t *const pixel = &frame_[3 * (y * width_ + x)];
+    pixel[0] = col.r;
+    pixel[1] = col.g;
+    pixel[2] = col.b;
+    ++pixels_;
+}
+
+void NullFlaschenTaschen::Blit(int x, int y, int w, int h,
+                               const uint8_t *rgb, size_t stride) {
+    if (!ClipToCanvas(&x, &y, &w, &h, &rgb, stride)) return;
+    if (start_time_usec_ < 0) start_time_usec_ = CurrentTimeMicros();
+    for (int row = y; row < y + h; ++row, rgb += stride) {
+        memcpy(&frame_[3 * (row * width_ + x)], rgb, 3 * w);
+    }
+    pixels_ += w * h;
+}
+
+void NullFlaschenTaschen::Send() {
+    if (start_time_usec_ < 0)
+        return;  // Only count frames once we got content.
+    ++frames_;
+    if (measure_latency_)
+        CollectLatencyProbes();
+    if (checksum_fd_ < 0)
+        return;
+    char line[64];
+    const int len = snprintf(line, sizeof(line), "%lld %016llx\n",
+                             (long long)frames_,
+                             (unsigned long long)Checksum(&frame_[0],
+                                                          frame_.size()));
+    if (write(checksum_fd_, line, len) != len) {
+        perror("Writing frame checksum");
+    }
+}
+
+void NullFlaschenTaschen::CollectLatencyProbes() {
+    // Probes are visible until overwritten, e.g. left behind by a sprite,
+    // so we only count each probe once; all older than this are stale.
+    static const int64_t kMaxAgeUsec = 10 * 1000000;
+    const uint64_t now = LatencyProbeNow();
+    uint64_t sent;
+    for (size_t i = 0; i + kLatencyProbeBytes <= frame_.size(); i += 3) {
+        if (!ReadLatencyProbe(&frame_[i], &sent))
+            continue;
+        const int64_t age = LatencyProbeAge(now, sent);
+        if (age < kMaxAgeUsec && seen_probes_.insert(sent).second)
+            latencies_usec_.push_back(age);
+    }
+    while (!seen_probes_.empty() &&
+           LatencyProbeAge(now, *seen_probes_.begin()) >= kMaxAgeUsec) {
+        seen_probes_.erase(seen_probes_.begin());
+    }
+}
@@ -15,6 +15,7 @@
 // Receives http://openpixelcontrol.org/ and updates display.
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -23,29 +24,186 @@
 #include <unistd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <sys/time.h>
 
-#include "flaschen-taschen.h"
-#include "ft-thread.h"
+#include <vector>
+
+#include "composite-flaschen-taschen.h"
+#include "event-loop.h"
 #include "servers.h"
 
-#define SHOW_REFRESH_RATE 0
+static const int kHeaderSize = 4;
+static const int kMaxMessageSize = kHeaderSize + 65535;
+
+// Connections we serve at the same time.
+static const int kMaxConnections = 64;
+
+enum {
+    OPC_SET_PIXEL_COLORS = 0
+};
 
 struct Header {
-    uint8_t y_pos;
+    uint8_t channel;
     uint8_t command;
     uint8_t size_hi;
     uint8_t size_lo;
 };
 
-static bool reliable_read(int fd, void *buf, size_t count) {
-    ssize_t r;
-    while ((r = read(fd, buf, count)) > 0) {
-        count -= r;
-        buf = (char*)buf + r;
+// OPC seems to be in the mindset that a display is essentially a single,
+// gigantically back and forth wrapped strip. At least in the default 'wall'
+// configuration. Lets accomodate that: even rows go left to right, odd rows
+// right to left.
+//
+// The mapping from LED index to the byte offset in an image of the display
+// is computed once.
+namespace {
+class SerpentineLayout {
+public:
+    SerpentineLayout(int width, int height)
+        : width_(width), height_(height), offsets_(width * height) {
+        for (int i = 0; i < width * height; ++i) {
+            const int row = i / width;
+            const int col = i % width;
+            const int x = (row % 2 == 0) ? col : width - col - 1;
+            offsets_[i] = 3 * (row * width + x);
+        }
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int size() const { return offsets_.size(); }
+
+    // Copy "count" pixels in LED order to their place in "image".
+    void Scatter(const uint8_t *rgb, int count, uint8_t *image) const {
+        if (count > size()) count = size();
+        const uint32_t *offset = &offsets_[0];
+        for (int i = 0; i < count; ++i, rgb += 3) {
+            uint8_t *const pixel = image + offset[i];
+            pixel[0] = rgb[0];
+            pixel[1] = rgb[1];
+            pixel[2] = rgb[2];
+        }
+    }
+
+private:
+    const int width_;
+    const int height_;
+    std::vector<uint32_t> offsets_;   // LED index -> byte offset in image.
+};
+
+// One client connection. Messages are received into a buffer that is kept
+// for the lifetime of the connection, the pixels of all messages received
+// in one round are collected in an image of the display and then copied
+// with Blit().
+class OPCConnection : public EventHandler {
+public:
+    OPCConnection(int fd, const SerpentineLayout *layout, EventLoop *loop,
+                  int *connection_count)
+        : fd_(fd), layout_(layout), loop_(loop),
+          connection_count_(connection_count),
+          buffer_(new uint8_t[kMaxMessageSize]), buffer_fill_(0),
+          image_(new uint8_t[3 * layout->size()]), pixels_(0) {
+        memset(image_, 0, 3 * layout->size());
+        ++*connection_count_;
+    }
+
+    virtual ~OPCConnection() {
+        close(fd_);
+        delete [] image_;
+        delete [] buffer_;
+        --*connection_count_;
+    }
+
+    virtual bool HandleReadable(int64_t now_ms) {
+        const ssize_t r = recv(fd_, buffer_ + buffer_fill_,
+                               kMaxMessageSize - buffer_fill_, MSG_DONTWAIT);
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return false;
+        if (r <= 0) {
+            loop_->Remove(this);   // Hung up.
+            return false;
+        }
+        buffer_fill_ += r;
+
+        // Each message starts at the first LED, so the pixels of several
+        // messages can be collected in one image: later ones overwrite
+        // earlier ones, and the pixels set are always a prefix of the strip.
+        pixels_ = 0;
+        int pos = 0;
+        while (buffer_fill_ - pos >= kHeaderSize) {
+            const Header *h = (const Header*) (buffer_ + pos);
+            const int size = h->size_hi << 8 | h->size_lo;
+            if (buffer_fill_ - pos < kHeaderSize + size)
+                break;   // Rest of message not there yet.
+            if (h->command == OPC_SET_PIXEL_COLORS) {
+                const int leds = size / 3;
+                layout_->Scatter(buffer_ + pos + kHeaderSize, leds, image_);
+                if (leds > pixels_) pixels_ = leds;
+            }
+            pos += kHeaderSize + size;
+        }
+        if (pos > 0) {
+            memmove(buffer_, buffer_ + pos, buffer_fill_ - pos);
+            buffer_fill_ -= pos;
+        }
+        if (pixels_ > layout_->size()) pixels_ = layout_->size();
+        return pixels_ > 0;
+    }
+
+    virtual void Apply(CompositeFlaschenTaschen *display) {
+        const int width = layout_->width();
+        const int full_rows = pixels_ / width;
+        const int rest = pixels_ % width;
+        const int row_bytes = 3 * width;
+        display->SetLayer(0);
+        if (full_rows > 0) {
+            display->Blit(0, 0, width, full_rows, image_, row_bytes);
+        }
+        if (rest > 0) {   // Partial row: from the left or from the right.
+            const int x = (full_rows % 2 == 0) ? 0 : width - rest;
+            display->Blit(x, full_rows, rest, 1,
+                          image_ + full_rows * row_bytes + 3 * x, row_bytes);
+        }
     }
-    return count == 0;
-}
+
+private:
+    const int fd_;
+    const SerpentineLayout *const layout_;
+    EventLoop *const loop_;
+    int *const connection_count_;
+    uint8_t *const buffer_;    // Received, not handled yet.
+    int buffer_fill_;
+    uint8_t *const image_;     // Display image the messages are scattered in.
+    int pixels_;               // LEDs set in this round.
+};
+
+class OPCListener : public EventHandler {
+public:
+    OPCListener(int fd, int width, int height, EventLoop *loop)
+        : fd_(fd), layout_(width, height), loop_(loop), connection_count_(0) {}
+
+    virtual ~OPCListener() { close(fd_); }
+
+    virtual bool HandleReadable(int64_t now_ms) {
+        const int fd = accept(fd_, NULL, NULL);
+        if (fd < 0)
+            return false;
+        if (connection_count_ >= kMaxConnections) {
+            close(fd);
+            return false;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        loop_->Add(fd, new OPCConnection(fd, &layout_, loop_,
+                                         &connection_count_));
+        return false;
+    }
+
+private:
+    const int fd_;
+    const SerpentineLayout layout_;
+    EventLoop *const loop_;
+    int connection_count_;
+};
+}  // namespace
 
 // Open server. Return file-descriptor or -1 if listen fails.
 static int open_server(int port) {
@@ -71,77 +229,16 @@ static int open_server(int port) {
     if (bind(s, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
         fprintf(stderr, "OPC: Trouble binding to port %d: %s",
                 port, strerror(errno));
+        close(s);
         return -1;
     }
-    return s;
-}
-
-static void handle_connection(int fd, FlaschenTaschen *display,
-                              ft::Mutex *mutex) {
-    bool any_error = false;
-    while (!any_error) {
-#if SHOW_REFRESH_RATE
-        struct timeval start, end;
-        gettimeofday(&start, NULL);
-#endif
-
-        struct Header h;
-        if (!reliable_read(fd, &h, sizeof(h)))
-            break;  // lazily assume that we get enough.
-        uint16_t size = (uint16_t) h.size_hi << 8 | h.size_lo;
-        uint8_t *buffer = new uint8_t[ size ];
-        if (!reliable_read(fd, buffer, size))
-            any_error = true;
-        int leds = size / 3;
-        uint8_t *pixel_pos = buffer;
-        mutex->Lock();
-        for (int x = 0; x < leds; ++x) {
-            Color c;
-            c.r = *pixel_pos++;
-            c.g = *pixel_pos++;
-            c.b = *pixel_pos++;
-
-            // Ideally, we'd think that we can have the channel denote the
-            // y-axis, then x-axis is the pixel.
-            //display->SetPixel(x, h.y_pos, c);
-
-            // .. However OPC seems to be in the mindset that a display
-            // is essentially a single, gigantically back and forth
-            // wrapped strip. At least in the default 'wall' configuration.
-            // Lets accomodate that.
-            const int col = x % display->width();
-            const int row = x / display->width();
-            display->SetPixel(row % 2 == 0 ? col : display->width() - col - 1,
-                              row, c);
-        }
-        display->Send();
-        mutex->Unlock();
-        delete [] buffer;
-#if SHOW_REFRESH_RATE
-        gettimeofday(&end, NULL);
-        int64_t usec = ((uint64_t)end.tv_sec * 1000000 + end.tv_usec)
-            - ((int64_t)start.tv_sec * 1000000 + start.tv_usec);
-        printf("\b\b\b\b\b\b\b\b%6.1fHz", 1e6 / usec);
-#endif
-    }
-}
-
-static void run_server(int listen_socket,
-                       FlaschenTaschen *display, ft::Mutex *mutex) {
-    if (listen(listen_socket, 2) < 0) {
+    if (listen(s, kMaxConnections) < 0) {
         fprintf(stderr, "OPC: listen() failed: %s", strerror(errno));
-        return;
-    }
-    
-    for (;;) {
-        struct sockaddr_in client;
-        socklen_t socklen = sizeof(client);
-        int fd = accept(listen_socket, (struct sockaddr*) &client, &socklen);
-        if (fd < 0) return;
-        handle_connection(fd, display, mutex);
+        close(s);
+        return -1;
     }
-
-    close(listen_socket);
+    fcntl(s, F_SETFD, FD_CLOEXEC);
+    return s;
 }
 
 // public interface
@@ -156,21 +253,11 @@ bool opc_server_init(int port) {
     return true;
 }
 
-class OPCThread : public ft::Thread {
-public:
-    OPCThread(FlaschenTaschen *display, ft::Mutex *mutex)
-        : display_(display), mutex_(mutex) {}
-
-    virtual void Run() {
-        run_server(server_socket, display_, mutex_);
-    }
-
-private:
-    FlaschenTaschen *const display_;
-    ft::Mutex *const mutex_;
-};
-
-void opc_server_run_thread(FlaschenTaschen *display, ft::Mutex *mutex) {
-    OPCThread *thread = new OPCThread(display, mutex);
-    thread->Start();
+void opc_server_start(EventLoop *event_loop,
+                      const CompositeFlaschenTaschen *display) {
+    if (server_socket < 0)
+        return;
+    event_loop->Add(server_socket,
+                    new OPCListener(server_socket, display->width(),
+                                    display->height(), event_loop));
 }
@@ -0,0 +1,159 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Checks that ReadImageData() with its fast path gives the same result as
+// the general parser for randomly mutated headers, then compares the speed
+// of both. Build with 'make ppm-reader-bench'. Exits with a non-zero
+// status if results differ.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <string>
+#include <vector>
+
+#include "ppm-reader.h"
+
+namespace {
+int64_t CurrentTimeMicros() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+std::string MakeHeader(int w, int h, int x, int y, int z, bool with_offset) {
+    char buffer[128];
+    if (with_offset) {
+        snprintf(buffer, sizeof(buffer), "P6\n%d %d\n#FT: %d %d %d\n255\n",
+                 w, h, x, y, z);
+    } else {
+        snprintf(buffer, sizeof(buffer), "P6\n%d %d\n255\n", w, h);
+    }
+    return buffer;
+}
+
+// A header as the client library sends it, or something close to it.
+std::string RandomPacket() {
+    const int w = random() % 50, h = random() % 40;
+    std::string packet = MakeHeader(w, h, random() % 100 - 50,
+                                    random() % 100 - 50, random() % 20,
+                                    random() % 4 != 0);
+    const char kInteresting[] = "P6#FT: 0123456789-+\n\t\r 255x";
+    const int mutations = random() % 4;
+    for (int i = 0; i < mutations && !packet.empty(); ++i) {
+        const size_t pos = random() % packet.size();
+        const char c = (random() % 2)
+            ? kInteresting[random() % (sizeof(kInteresting) - 1)]
+            : (char) random();
+        switch (random() % 3) {
+        case 0: packet[pos] = c; break;
+        case 1: packet.insert(pos, 1, c); break;
+        case 2: packet.erase(pos, 1); break;
+        }
+    }
+    // Mostly the right amount of image data, sometimes more or less.
+    int data = 3 * w * h;
+    switch (random() % 6) {
+    case 0: data -= random() % 10; break;
+    case 1: data += random() % 10; break;
+    }
+    if (data > 0) packet.append(data, '\x80');
+    if (random() % 10 == 0) packet.append(" 1 2 3");  // Offset in footer.
+    return packet;
+}
+
+bool SameResult(const std::string &packet) {
+    // Terminate, as the general parser relies on strtol() to stop.
+    std::vector<char> buffer(packet.begin(), packet.end());
+    buffer.resize(packet.size() + 16, '\0');
+    ImageMetaInfo expected = { -1, -2, -3, -4, -5, -6 };
+    ImageMetaInfo actual = expected;
+    const char *expected_data
+        = ReadImageDataGeneral(&buffer[0], packet.size(), &expected);
+    const char *actual_data = ReadImageData(&buffer[0], packet.size(), &actual);
+    if (expected_data == actual_data &&
+        memcmp(&expected, &actual, sizeof(expected)) == 0) {
+        return true;
+    }
+    fprintf(stderr, "Mismatch for header '%s'\n",
+            packet.substr(0, 40).c_str());
+    fprintf(stderr, "  general: data at %d %dx%d range=%d x=%d y=%d z=%d\n",
+            (int)(expected_data - &buffer[0]), expected.width,
+            expected.height, expected.range, expected.offset_x,
+            expected.offset_y, expected.layer);
+    fprintf(stderr, "  fast   : data at %d %dx%d range=%d x=%d y=%d z=%d\n",
+            (int)(actual_data - &buffer[0]), actual.width,
+            actual.height, actual.range, actual.offset_x,
+            actual.offset_y, actual.layer);
+    return false;
+}
+
+typedef const char *(*ReadFunction)(const char *, size_t, ImageMetaInfo *);
+
+// Returns nanoseconds per call.
+double Time(ReadFunction read, const std::vector<std::string> &packets,
+            int rounds) {
+    ImageMetaInfo info;
+    size_t sum = 0;  // Keep the compiler from optimizing everything away.
+    const int64_t start = CurrentTimeMicros();
+    for (int r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < packets.size(); ++i) {
+            sum += read(packets[i].data(), packets[i].size(), &info)
+                - packets[i].data();
+        }
+    }
+    const int64_t duration = CurrentTimeMicros() - start;
+    if (sum == 0) fprintf(stderr, "(no data found)\n");
+    return 1000.0 * duration / ((double)rounds * packets.size());
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    const int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    int failures = 0;
+    std::string previous;
+    for (int i = 0; i < iterations; ++i) {
+        // Repeat packets now and then to exercise the header cache.
+        const std::string packet = (i > 0 && random() % 3 == 0)
+            ? previous : RandomPacket();
+        if (!SameResult(packet) && ++failures >= 10)
+            break;
+        previous = packet;
+    }
+    printf("%d random packets: %d mismatches\n", iterations, failures);
+
+    // Full frame as the client library sends it, the same header each time.
+    const std::string header = MakeHeader(45, 35, 0, 0, 0, true);
+    std::vector<std::string> same(1, header + std::string(3*45*35, '\x80'));
+
+    // Different tiles, so that the header cache does not help.
+    std::vector<std::string> tiles;
+    for (int i = 0; i < 16; ++i) {
+        tiles.push_back(MakeHeader(9, 7, 9 * (i % 5), 7 * (i / 5), i % 3, true)
+                        + std::string(3*9*7, '\x80'));
+    }
+
+    const int rounds = 1000000;
+    printf("ns per header         general    fast\n");
+    printf("  repeated header     %7.1f %7.1f\n",
+           Time(&ReadImageDataGeneral, same, rounds),
+           Time(&ReadImageData, same, rounds));
+    printf("  changing headers    %7.1f %7.1f\n",
+           Time(&ReadImageDataGeneral, tiles, rounds / 16),
+           Time(&ReadImageData, tiles, rounds / 16));
+    return failures == 0 ? 0 : 1;
+}
@@ -16,9 +16,10 @@
 
 #include "ppm-reader.h"
 
-#include <string.h>
-#include <stdlib.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 // We also parse meta values in comments, so readNextNumber() and
 // skipWhitespace() also take ImageMetaInfo to extract recursively.
@@ -78,8 +79,8 @@ static int readNextNumber(const char **start, const char *end,
     return result;
 }
 
-const char *ReadImageData(const char *in_buffer, size_t buf_len,
-                          struct ImageMetaInfo *info) {
+const char *ReadImageDataGeneral(const char *in_buffer, size_t buf_len,
+                                 struct ImageMetaInfo *info) {
     if (in_buffer[0] != 'P' || in_buffer[1] != '6' ||
         (!isspace(in_buffer[2]) && in_buffer[2] != '#')) {
         return in_buffer;  // raw image. No P6 magic header.
@@ -111,3 +112,108 @@ const char *ReadImageData(const char *in_buffer, size_t buf_len,
     info->range = range;
     return parse_buffer;
 }
+
+// -- Fast path.
+// Practically all packets are sent by the client library, with a header
+// "P6\n<width> <height>\n#FT: <x> <y> <z>\n255\n" (the #FT line being
+// optional) and no footer. Also, a client typically sends the very same
+// header over and over again. So we first compare with the last header we
+// have seen, then try to parse exactly that format. Anything else, or
+// anything that is not followed by exactly the image data, goes the general
+// way, which then also takes care of all the corner cases.
+
+namespace {
+struct HeaderCache {
+    enum { kMaxHeaderLen = 48 };  // Longest header we parse in the fast path.
+    char header[kMaxHeaderLen];
+    size_t len;          // 0 if nothing cached.
+    bool has_offsets;
+    ImageMetaInfo info;
+};
+}  // namespace
+
+// One per thread, so that receiver threads don't need to share.
+static __thread HeaderCache header_cache;
+
+// Parse decimal number of up to five digits, followed by "delimiter". Returns
+// pointer after delimiter or NULL if not in that format.
+static inline const char *ParseNumber(const char *p, const char *end,
+                                      char delimiter, int *result) {
+    const bool negative = (p < end && *p == '-');
+    if (negative) ++p;
+    const char *const digits_end = (end - p > 6) ? p + 6 : end;
+    const char *const start = p;
+    int value = 0;
+    unsigned digit;
+    while (p < digits_end && (digit = (unsigned char)*p - '0') < 10) {
+        value = 10 * value + digit;
+        ++p;
+    }
+    if (p == start || p - start > 5 || p >= end || *p != delimiter)
+        return NULL;
+    *result = negative ? -value : value;
+    return p + 1;
+}
+
+static const char *ParseCommonHeader(const char *in_buffer, size_t buf_len,
+                                     HeaderCache *parsed) {
+    const char *const end = in_buffer + buf_len;
+    const char *p = in_buffer + 3;  // "P6\n" already checked.
+    ImageMetaInfo &info = parsed->info;
+    if ((p = ParseNumber(p, end, ' ', &info.width)) == NULL ||
+        (p = ParseNumber(p, end, '\n', &info.height)) == NULL ||
+        info.width < 0 || info.height < 0)
+        return NULL;
+    parsed->has_offsets = (end - p >= 5 && memcmp(p, "#FT: ", 5) == 0);
+    if (parsed->has_offsets) {
+        p += 5;
+        if ((p = ParseNumber(p, end, ' ', &info.offset_x)) == NULL ||
+            (p = ParseNumber(p, end, ' ', &info.offset_y)) == NULL ||
+            (p = ParseNumber(p, end, '\n', &info.layer)) == NULL)
+            return NULL;
+    }
+    if (end - p < 4 || memcmp(p, "255\n", 4) != 0)
+        return NULL;
+    p += 4;
+    info.range = 255;
+    if ((size_t)(end - p) != (size_t)info.width * info.height * 3)
+        return NULL;  // Footer or not enough data.
+    parsed->len = p - in_buffer;
+    return p;
+}
+
+static inline void CopyInfo(const HeaderCache &cached, ImageMetaInfo *info) {
+    info->width = cached.info.width;
+    info->height = cached.info.height;
+    info->range = cached.info.range;
+    if (cached.has_offsets) {
+        info->offset_x = cached.info.offset_x;
+        info->offset_y = cached.info.offset_y;
+        info->layer = cached.info.layer;
+    }
+}
+
+const char *ReadImageData(const char *in_buffer, size_t buf_len,
+                          struct ImageMetaInfo *info) {
+    HeaderCache &cache = header_cache;
+    if (cache.len > 0 && buf_len >= cache.len &&
+        memcmp(in_buffer, cache.header, cache.len) == 0 &&
+        buf_len - cache.len
+        == (size_t)cache.info.width * cache.info.height * 3) {
+        CopyInfo(cache, info);
+        return in_buffer + cache.len;
+    }
+
+    if (buf_len >= 4 && memcmp(in_buffer, "P6\n", 3) == 0) {
+        HeaderCache parsed;
+        const char *data = ParseCommonHeader(in_buffer, buf_len, &parsed);
+        if (data != NULL && parsed.len <= HeaderCache::kMaxHeaderLen) {
+            memcpy(parsed.header, in_buffer, parsed.len);
+            cache = parsed;
+            CopyInfo(cache, info);
+            return data;
+        }
+    }
+
+    return ReadImageDataGeneral(in_buffer, buf_len, info);
+}
@@ -16,6 +16,9 @@
 // only has width/height but also offset information in x,y and z (=layer)
 // direction.
 
+#ifndef FT_PPM_READER_H
+#define FT_PPM_READER_H
+
 #include <stdlib.h>
 
 struct ImageMetaInfo {
@@ -38,5 +41,15 @@ struct ImageMetaInfo {
 // information.
 // This also extracts the FlaschenTaschen extension to the PPM image format
 // that contains the offset.
+//
+// Recognizes the headers sent by the client library quickly; the last header
+// seen in a thread is cached.
 const char *ReadImageData(const char *in_buffer, size_t buf_len,
 			  struct ImageMetaInfo *info_out);
+
+// Same as ReadImageData(), but always going through the general parser.
+// For testing and benchmarking.
+const char *ReadImageDataGeneral(const char *in_buffer, size_t buf_len,
+                                 struct ImageMetaInfo *info_out);
+
+#endif  // FT_PPM_READER_H
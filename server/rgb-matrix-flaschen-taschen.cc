@@ -25,6 +25,7 @@ RGBMatrixFlaschenTaschen::RGBMatrixFlaschenTaschen(
         fprintf(stderr, "Couldn't initialize RGB matrix.\n");
         exit(1);
     }
+    offscreen_ = matrix_->CreateFrameCanvas();
     width_ = (width > 0) ? width : matrix_->width();
     height_ = (height > 0) ? height : matrix_->height();
     fprintf(stderr, "Running with %dx%d resolution\n", width_, height_);
@@ -35,7 +36,26 @@ RGBMatrixFlaschenTaschen::~RGBMatrixFlaschenTaschen() {
 }
 
 void RGBMatrixFlaschenTaschen::SetPixel(int x, int y, const Color &col) {
-    matrix_->SetPixel(x, y, col.r, col.g, col.b);
+    offscreen_->SetPixel(x, y, col.r, col.g, col.b);
+}
+
+void RGBMatrixFlaschenTaschen::Blit(int x, int y, int w, int h,
+                                    const uint8_t *rgb, size_t stride) {
+    if (!ClipToCanvas(&x, &y, &w, &h, &rgb, stride)) return;
+    for (int row = y; row < y + h; ++row, rgb += stride) {
+        const uint8_t *pixel = rgb;
+        for (int col = x; col < x + w; ++col, pixel += 3) {
+            offscreen_->SetPixel(col, row, pixel[0], pixel[1], pixel[2]);
+        }
+    }
+}
+
+void RGBMatrixFlaschenTaschen::Send() {
+    rgb_matrix::FrameCanvas *const shown = offscreen_;
+    offscreen_ = matrix_->SwapOnVSync(offscreen_);
+    // Callers might only update the pixels that changed, so start the next
+    // frame with what is on the screen now.
+    offscreen_->CopyFrom(*shown);
 }
 
 void RGBMatrixFlaschenTaschen::PostDaemonInit() {
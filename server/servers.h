@@ -16,24 +16,88 @@
 #ifndef FT_SERVER_H
 #define FT_SERVER_H
 
+#include <stdint.h>
+
 class FlaschenTaschen;
 class CompositeFlaschenTaschen;
+class EventLoop;
 
 namespace ft {
 class Mutex;
 }
 
-// Our main service that we always support.
-bool udp_server_init(int port);
+// Tuning of the UDP receive loop.
+struct UDPServerOptions {
+    UDPServerOptions()
+        : batch_size(16), batch_wait_ms(0),
+          receiver_threads(1), receiver_cpu_mask(0),
+          frame_deadline_ms(20),
+          source_packets_per_second(0), source_bytes_per_second(0),
+          coalesce(false) {}
+
+    // Maximum number of datagrams drained from the socket per wakeup. All
+    // of them are applied with one lock acquisition and one Send().
+    // A value of 1 handles each packet individually.
+    int batch_size;
+
+    // After the first datagram arrived, wait up to this many milliseconds
+    // for the batch to fill up. With 0, only what is already pending in the
+    // kernel is taken.
+    int batch_wait_ms;
+
+    // Number of receiving threads, each with its own SO_REUSEPORT socket.
+    // The kernel distributes senders between them, so header parsing
+    // runs in parallel; only compositing is serialized. The first socket
+    // is served by the event loop, together with the other front-ends.
+    int receiver_threads;
+
+    // If non-zero, additional receiver threads are pinned round-robin to
+    // the CPUs in this mask.
+    uint32_t receiver_cpu_mask;
+
+    // Frames that a client sends as several tiles (binary protocol only)
+    // are shown in one display update once all tiles are there. If tiles
+    // are missing after this many milliseconds, the frame is shown as far
+    // as it arrived. With 0, tiles are shown as they arrive.
+    int frame_deadline_ms;
+
+    // Budget of each sending host in packets and bytes per second, with
+    // bursts of up to a quarter second worth. Datagrams beyond that are
+    // dropped. 0 is unlimited. Counters per host are printed on SIGUSR1.
+    int source_packets_per_second;
+    int source_bytes_per_second;
+
+    // If the display can't keep up, drain everything queued up and, of
+    // the images a source sent to the same place, only show the newest.
+    // Keeps latency low under overload instead of working through stale
+    // images one by one.
+    bool coalesce;
+};
+
+// Our main service that we always support. Runs "event_loop" until
+// interrupted; the first receiver is served by it, additional ones have
+// their own thread.
+bool udp_server_init(int port, const UDPServerOptions &options);
 void udp_server_run_blocking(CompositeFlaschenTaschen *display,
-                             ft::Mutex *mutex);
+                             ft::Mutex *mutex,
+                             const UDPServerOptions &options,
+                             EventLoop *event_loop);
+
+// Frames from producers on the same machine through shared memory; see
+// local-protocol.h. Listens on the Unix domain socket "path"; connections
+// are served by the event loop.
+bool local_server_init(const char *path);
+void local_server_start(EventLoop *event_loop);
+
+// http://openpixelcontrol.org/ on TCP "port", with any number of
+// connections served by the event loop.
+bool opc_server_init(int port);
+void opc_server_start(EventLoop *event_loop,
+                      const CompositeFlaschenTaschen *display);
 
 // Optional services, currently disabled.
 // These should probably be moved out of this project and implemented
 // as a bridge.
-bool opc_server_init(int port);
-void opc_server_run_thread(FlaschenTaschen *display, ft::Mutex *mutex);
-
 bool pixel_pusher_init(const char *interface, FlaschenTaschen *canvas);
 void pixel_pusher_run_thread(FlaschenTaschen *display, ft::Mutex *mutex);
 
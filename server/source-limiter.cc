@@ -0,0 +1,122 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "source-limiter.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+
+// Slots looked at for a source before the least recently seen one in that
+// range is replaced.
+static const int kMaxProbe = 16;
+
+static const int kMaxDatagramSize = 65535;
+
+static uint32_t HashAddress(const uint8_t *address) {
+    uint32_t hash = 2166136261u;   // FNV-1a
+    for (int i = 0; i < 16; ++i) {
+        hash = (hash ^ address[i]) * 16777619u;
+    }
+    return hash;
+}
+
+SourceLimiter::SourceLimiter(int packets_per_second, int bytes_per_second)
+    : packets_per_usec_(packets_per_second / 1e6),
+      bytes_per_usec_(bytes_per_second / 1e6),
+      packet_burst_(std::max(1.0, packets_per_second / 4.0)),
+      byte_burst_(std::max((double)kMaxDatagramSize, bytes_per_second / 4.0)) {
+    bzero(table_, sizeof(table_));
+}
+
+SourceLimiter::Source *SourceLimiter::Lookup(const SourceAddress &source,
+                                             int64_t now_usec) {
+    const uint32_t hash = HashAddress(source.address);
+    Source *oldest = NULL;
+    for (int i = 0; i < kMaxProbe; ++i) {
+        Source *s = &table_[(hash + i) & (kTableSize - 1)];
+        if (!s->in_use) {
+            oldest = s;   // Sources are never removed, so it's not further on.
+            break;
+        }
+        if (memcmp(s->address, source.address, sizeof(s->address)) == 0)
+            return s;
+        if (oldest == NULL || s->last_seen_usec < oldest->last_seen_usec)
+            oldest = s;
+    }
+    bzero(oldest, sizeof(*oldest));
+    memcpy(oldest->address, source.address, sizeof(oldest->address));
+    oldest->in_use = true;
+    oldest->last_seen_usec = now_usec;
+    oldest->packet_tokens = packet_burst_;
+    oldest->byte_tokens = byte_burst_;
+    return oldest;
+}
+
+bool SourceLimiter::Consume(Source *s, size_t bytes, int64_t now_usec) {
+    const int64_t elapsed = now_usec - s->last_seen_usec;
+    s->last_seen_usec = now_usec;
+    s->packets++;
+    s->bytes += bytes;
+
+    if (packets_per_usec_ > 0) {
+        s->packet_tokens = std::min(packet_burst_, s->packet_tokens
+                                    + elapsed * packets_per_usec_);
+    }
+    if (bytes_per_usec_ > 0) {
+        s->byte_tokens = std::min(byte_burst_, s->byte_tokens
+                                  + elapsed * bytes_per_usec_);
+    }
+    if ((packets_per_usec_ > 0 && s->packet_tokens < 1) ||
+        (bytes_per_usec_ > 0 && s->byte_tokens < bytes)) {
+        s->dropped_packets++;
+        return false;
+    }
+    s->packet_tokens -= 1;
+    s->byte_tokens -= bytes;
+    return true;
+}
+
+void SourceLimiter::Admit(const SourceAddress *sources, const size_t *sizes,
+                          int count, int64_t now_usec,
+                          bool *admitted, int *slot) {
+    ft::MutexLock l(&mutex_);
+    for (int i = 0; i < count; ++i) {
+        Source *s = Lookup(sources[i], now_usec);
+        admitted[i] = Consume(s, sizes[i], now_usec);
+        slot[i] = s - table_;
+    }
+}
+
+void SourceLimiter::AddDropped(int slot) {
+    ft::MutexLock l(&mutex_);
+    table_[slot].dropped_packets++;
+}
+
+void SourceLimiter::PrintStats(FILE *out) {
+    ft::MutexLock l(&mutex_);
+    fprintf(out, "%-40s %12s %14s %12s\n",
+            "source", "packets", "bytes", "dropped");
+    for (int i = 0; i < kTableSize; ++i) {
+        const Source &s = table_[i];
+        if (!s.in_use) continue;
+        char name[INET6_ADDRSTRLEN];
+        inet_ntop(AF_INET6, s.address, name, sizeof(name));
+        fprintf(out, "%-40s %12lld %14lld %12lld\n", name,
+                (long long)s.packets, (long long)s.bytes,
+                (long long)s.dropped_packets);
+    }
+}
@@ -0,0 +1,82 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef FT_SOURCE_LIMITER_H
+#define FT_SOURCE_LIMITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "frame-assembler.h"
+#include "ft-thread.h"
+
+// Keeps track of the hosts sending to us and limits each of them to a budget
+// of packets and bytes per second, so that one client flooding the server
+// does not starve everyone else.
+//
+// Budgets are token buckets that allow bursts of a quarter second worth of
+// traffic. Hosts are identified by address only: a client opening more
+// sockets doesn't get a larger budget.
+//
+// Sources are kept in a fixed size open addressing hash table; if it is
+// full, the source not heard from the longest is forgotten.
+//
+// Thread-safe; shared by all receiver threads.
+class SourceLimiter {
+public:
+    static const int kTableSize = 1024;   // Power of two.
+
+    // Budgets per source and second; 0 is unlimited.
+    SourceLimiter(int packets_per_second, int bytes_per_second);
+
+    // Account for "count" datagrams from "sources" with the given
+    // sizes received at "now_usec". Sets admitted[i] to whether datagram i is
+    // within the budget of its source, and slot[i] to a number identifying
+    // the source in the range [0..kTableSize).
+    void Admit(const SourceAddress *sources, const size_t *sizes, int count,
+               int64_t now_usec, bool *admitted, int *slot);
+
+    // Count a datagram of the source identified by "slot" as dropped after
+    // all, e.g. because the server is too far behind.
+    void AddDropped(int slot);
+
+    // Print counters per source.
+    void PrintStats(FILE *out);
+
+private:
+    struct Source {
+        uint8_t address[16];
+        bool in_use;
+        int64_t last_seen_usec;
+        double packet_tokens;
+        double byte_tokens;
+
+        int64_t packets;       // Counters, admitted or not.
+        int64_t bytes;
+        int64_t dropped_packets;
+    };
+
+    Source *Lookup(const SourceAddress &source, int64_t now_usec);
+    bool Consume(Source *s, size_t bytes, int64_t now_usec);
+
+    const double packets_per_usec_;
+    const double bytes_per_usec_;
+    const double packet_burst_;
+    const double byte_burst_;
+    ft::Mutex mutex_;
+    Source table_[kTableSize];
+};
+
+#endif  // FT_SOURCE_LIMITER_H
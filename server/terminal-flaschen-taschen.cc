@@ -14,28 +14,34 @@
 
 #include "led-flaschen-taschen.h"
 
-#include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #define SCREEN_CLEAR    "\033c"
-#define SCREEN_PREFIX   "\033[48;2;0;0;0m"  // set black background
 #define SCREEN_POSTFIX  "\033[0m"           // reset terminal settings
-#define SCREEN_CURSOR_UP_FORMAT "\033[%dA"  // Move cursor up given lines.
 #define CURSOR_OFF      "\033[?25l"
 #define CURSOR_ON       "\033[?25h"
+#define CURSOR_POSITION_FORMAT "\033[%d;%dH"  // Line, column; starting at 1.
+#define CURSOR_RIGHT_FORMAT    "\033[%dC"
+#define CLEAR_LINE_REST "\033[K"
+
+#define FOREGROUND_COLOR "\033[38;2;"   // Followed by r;g;bm
+#define BACKGROUND_COLOR "\033[48;2;"
+
+// In standard resolution, a pixel is two spaces with the background color,
+// which makes a somewhat 1:1 aspect ratio pixel.
+#define PIXEL_CONTENT  "  "
 
-// We have all colors same width for fast in-place updates in a precalculated
-// buffer. So each pixel needs to be fixed width: we do %03d (which luckily is
-// not interpreted as octal by the terminal)
-#define PIXEL_PREFIX   "\033[48;2;"      // Setting 24-bit background color
-#define COLOR_FORMAT   "%03d;%03d;%03dm" // RGB color formatting
-#define PIXEL_CONTENT  "  "  // Two spaces make a somewhat 1:1 aspect ratio pixel
+// In high resolution, each character is divided in a top pixel and bottom
+// pixel. This character fills the top block: top pixel is the foreground
+// color, bottom pixel the background color.
+#define HD_PIXEL_CHARACTER "▀"
 
 #define FPS_PLACEHOLDER "___________"
-#define FPS_BACKSPACE   "\b\b\b\b\b\b\b\b\b\b\b"
 
 static void reliable_write(int fd, const char *buf, size_t size) {
     int written;
@@ -45,32 +51,39 @@ static void reliable_write(int fd, const char *buf, size_t size) {
     }
 }
 
-TerminalFlaschenTaschen::TerminalFlaschenTaschen(int fd, int width, int height)
-    : terminal_fd_(fd), width_(width), height_(height), is_first_(true),
-      last_time_usec_(-1) {
+static bool SameColor(const Color &a, const Color &b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b;
 }
 
-void TerminalFlaschenTaschen::PostDaemonInit() {
-    buffer_.append(SCREEN_PREFIX);
-    initial_offset_ = buffer_.size();
-    char scratch[64];
-    snprintf(scratch, sizeof(scratch),
-             PIXEL_PREFIX COLOR_FORMAT PIXEL_CONTENT, 0, 0, 0);  // black pixel.
-    pixel_offset_ = strlen(scratch);
-    for (int y = 0; y < height_; ++y) {
-        for (int x = 0; x < width_; ++x) {
-            buffer_.append(scratch);
-        }
-        buffer_.append("\n");
-    }
-
-    buffer_.append(SCREEN_POSTFIX);
+static void AppendDecimal(std::string *out, uint8_t value) {
+    char buf[3];
+    int len = 0;
+    if (value >= 100) buf[len++] = '0' + value / 100;
+    if (value >= 10) buf[len++] = '0' + value / 10 % 10;
+    buf[len++] = '0' + value % 10;
+    out->append(buf, len);
+}
 
-    fps_offset_ = buffer_.size();
-    buffer_.append(FPS_PLACEHOLDER FPS_BACKSPACE);
+// Append escape sequence "sgr" with the color.
+static void AppendColor(std::string *out, const char *sgr, const Color &col) {
+    out->append(sgr);
+    AppendDecimal(out, col.r);
+    out->append(1, ';');
+    AppendDecimal(out, col.g);
+    out->append(1, ';');
+    AppendDecimal(out, col.b);
+    out->append(1, 'm');
+}
 
-    snprintf(scratch, sizeof(scratch), SCREEN_CURSOR_UP_FORMAT, height_);
-    buffer_.append(scratch);
+TerminalFlaschenTaschen::TerminalFlaschenTaschen(int fd, int width, int height)
+    : rows_per_line_(1), columns_per_pixel_(2),
+      terminal_fd_(fd), width_(width), height_(height), is_first_(true),
+      last_time_usec_(-1),
+      frame_(width * height, Color(0, 0, 0)),
+      shown_(width * height, Color(0, 0, 0)),
+      all_(width, height),
+      foreground_set_(false), background_set_(false) {
+    all_.AddAll();
 }
 
 TerminalFlaschenTaschen::~TerminalFlaschenTaschen() {
@@ -82,37 +95,125 @@ TerminalFlaschenTaschen::~TerminalFlaschenTaschen() {
 
 void TerminalFlaschenTaschen::SetPixel(int x, int y, const Color &col) {
     if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
-    const int pos = initial_offset_
-        + (width_ * y + x) * pixel_offset_
-        + strlen(PIXEL_PREFIX)   // Exactly where the color-formatting starts
-        + y;                     // <- one newline per y
-    char *buf = const_cast<char*>(buffer_.data()) + pos;  // Living on the edge
-    WriteByteDecimal(buf, col.r);      // rrr;___;___
-    WriteByteDecimal(buf + 4, col.g);  // ___;ggg;___
-    WriteByteDecimal(buf + 8, col.b);  // ___;___;bbb
+    frame_[y * width_ + x] = col;
+}
+
+void TerminalFlaschenTaschen::Blit(int x, int y, int w, int h,
+                                   const uint8_t *rgb, size_t stride) {
+    if (!ClipToCanvas(&x, &y, &w, &h, &rgb, stride)) return;
+    for (int row = y; row < y + h; ++row, rgb += stride) {
+        memcpy(&frame_[row * width_ + x], rgb, w * sizeof(Color));
+    }
 }
 
 void TerminalFlaschenTaschen::Send() {
+    SendPartial(all_);
+}
+
+void TerminalFlaschenTaschen::SendPartial(const DirtyRegion &changed) {
+    buffer_.clear();
     if (is_first_) {
-        assert(!buffer_.empty());  // Looks like PostDaemonInit() was not called
-        reliable_write(terminal_fd_, SCREEN_CLEAR, strlen(SCREEN_CLEAR));
-        reliable_write(terminal_fd_, CURSOR_OFF, strlen(CURSOR_OFF));
-        is_first_ = false;
+        buffer_.append(SCREEN_CLEAR CURSOR_OFF);
+    }
+    // Whatever was set before, the status line reset it.
+    foreground_set_ = background_set_ = false;
+
+    const int lines = height_ / rows_per_line_;
+    const int first_line = is_first_ ? 0 : changed.first_row() / rows_per_line_;
+    const int last_line = is_first_
+        ? lines
+        : (changed.last_row() + rows_per_line_ - 1) / rows_per_line_;
+    for (int line = first_line; line < last_line; ++line) {
+        if (is_first_) {
+            AppendLine(line, 0, width_);
+            continue;
+        }
+        int begin = width_, end = 0;
+        for (int y = line * rows_per_line_;
+             y < (line + 1) * rows_per_line_ && y < height_; ++y) {
+            if (!changed.row_dirty(y)) continue;
+            begin = std::min(begin, changed.begin(y));
+            end = std::max(end, changed.end(y));
+        }
+        if (begin < end)
+            AppendLine(line, begin, end);
+    }
+    is_first_ = false;
+
+    AppendStatus(buffer_.size());
+    reliable_write(terminal_fd_, buffer_.data(), buffer_.size());
+}
+
+void TerminalFlaschenTaschen::AppendLine(int line, int begin, int end) {
+    const int top_row = line * rows_per_line_;
+    const int bottom_row = top_row + rows_per_line_ - 1;
+    const Color *const top = &frame_[top_row * width_];
+    const Color *const bottom = &frame_[bottom_row * width_];
+    Color *const shown_top = &shown_[top_row * width_];
+    Color *const shown_bottom = &shown_[bottom_row * width_];
+    char scratch[32];
+    int cursor = -1;   // Pixel the cursor is on, -1 if not in this line yet.
+    for (int x = begin; x < end; ++x) {
+        if (!is_first_ && SameColor(top[x], shown_top[x])
+            && SameColor(bottom[x], shown_bottom[x])) {
+            continue;   // The terminal already shows that.
+        }
+        if (cursor < 0) {
+            snprintf(scratch, sizeof(scratch), CURSOR_POSITION_FORMAT,
+                     line + 1, x * columns_per_pixel_ + 1);
+            buffer_.append(scratch);
+        } else if (cursor < x) {
+            snprintf(scratch, sizeof(scratch), CURSOR_RIGHT_FORMAT,
+                     (x - cursor) * columns_per_pixel_);
+            buffer_.append(scratch);
+        }
+        if (rows_per_line_ == 2) {
+            SetForeground(top[x]);
+            SetBackground(bottom[x]);
+            buffer_.append(HD_PIXEL_CHARACTER);
+        } else {
+            SetBackground(top[x]);
+            buffer_.append(PIXEL_CONTENT);
+        }
+        shown_top[x] = top[x];
+        shown_bottom[x] = bottom[x];
+        cursor = x + 1;
     }
+}
+
+void TerminalFlaschenTaschen::SetForeground(const Color &col) {
+    if (foreground_set_ && SameColor(foreground_, col))
+        return;
+    AppendColor(&buffer_, FOREGROUND_COLOR, col);
+    foreground_ = col;
+    foreground_set_ = true;
+}
 
-    char *fps_place = const_cast<char*>(buffer_.data()) + fps_offset_;
+void TerminalFlaschenTaschen::SetBackground(const Color &col) {
+    if (background_set_ && SameColor(background_, col))
+        return;
+    AppendColor(&buffer_, BACKGROUND_COLOR, col);
+    background_ = col;
+    background_set_ = true;
+}
+
+void TerminalFlaschenTaschen::AppendStatus(size_t frame_bytes) {
     struct timeval tp;
     gettimeofday(&tp, NULL);
     const int64_t time_now_usec = tp.tv_sec * 1000000 + tp.tv_usec;
     const int64_t duration = time_now_usec - last_time_usec_;
+    char fps[32];
     if (last_time_usec_ > 0 && duration > 500 && duration < 10000000) {
-        const float fps = 1e6 / duration;
-        snprintf(fps_place, strlen(FPS_PLACEHOLDER)+1, "%7.1f fps", fps);
-        fps_place[strlen(FPS_PLACEHOLDER)] = '\b';
+        snprintf(fps, sizeof(fps), "%7.1f fps", 1e6 / duration);
     } else {
-        memcpy(fps_place, FPS_PLACEHOLDER, strlen(FPS_PLACEHOLDER));
+        strncpy(fps, FPS_PLACEHOLDER, sizeof(fps));
     }
     last_time_usec_ = time_now_usec;
 
-    reliable_write(terminal_fd_, buffer_.data(), buffer_.size());
+    char scratch[128];
+    snprintf(scratch, sizeof(scratch),
+             SCREEN_POSTFIX CURSOR_POSITION_FORMAT "%s %8d bytes/frame"
+             CLEAR_LINE_REST,
+             height_ / rows_per_line_ + 1, 1, fps, (int)frame_bytes);
+    buffer_.append(scratch);
 }
@@ -0,0 +1,64 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "tile-coalescer.h"
+
+bool TileCoalescer::Place::operator<(const Place &other) const {
+    if (source < other.source) return true;
+    if (other.source < source) return false;
+    if (offset_x != other.offset_x) return offset_x < other.offset_x;
+    if (offset_y != other.offset_y) return offset_y < other.offset_y;
+    if (layer != other.layer) return layer < other.layer;
+    if (width != other.width) return width < other.width;
+    return height < other.height;
+}
+
+void TileCoalescer::Add(const SourceAddress &source, const ParsedPacket &tile) {
+    const ImageMetaInfo &info = tile.info;
+    Place place;
+    place.source = source;
+    place.offset_x = info.offset_x;
+    place.offset_y = info.offset_y;
+    place.layer = info.layer;
+    place.width = info.width;
+    place.height = info.height;
+
+    // Images that arrived later might overlap this one, so the new one goes
+    // to the end instead of replacing the old one where it is.
+    std::map<Place, int>::iterator found = index_.find(place);
+    if (found != index_.end()) {
+        entries_[found->second].superseded = true;
+        found->second = count_;
+        ++skipped_;
+    } else {
+        index_[place] = count_;
+    }
+    if (count_ == (int)entries_.size())
+        entries_.push_back(Entry());
+    Entry *const entry = &entries_[count_++];
+    entry->tile = tile;
+    entry->superseded = false;
+    entry->data.assign(tile.pixels, tile.pixels + 3 * info.width * info.height);
+}
+
+void TileCoalescer::TakeAll(std::vector<ParsedPacket> *tiles) {
+    for (int i = 0; i < count_; ++i) {
+        Entry &entry = entries_[i];
+        if (entry.superseded) continue;
+        entry.tile.pixels = entry.data.empty() ? NULL : &entry.data[0];
+        tiles->push_back(entry.tile);
+    }
+    index_.clear();
+    count_ = 0;
+}
@@ -0,0 +1,70 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef FT_TILE_COALESCER_H
+#define FT_TILE_COALESCER_H
+
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "frame-assembler.h"
+
+// If we can't keep up, there is no point in showing every image that is
+// queued up: only the newest one that a source sent to a particular place
+// is visible in the end anyway.
+//
+// This collects images and keeps only the latest for each source, position,
+// size and layer; earlier ones are skipped. The newest image keeps its own
+// position in the arrival order, so it still ends up above overlapping
+// images that arrived before it, and below those that arrived after it.
+// As it covers all of an earlier image at its place, skipping those is
+// also right if it is part of a delta frame.
+class TileCoalescer {
+public:
+    TileCoalescer() : count_(0), skipped_(0) {}
+
+    // Add "tile" from "source". Its pixels are copied.
+    void Add(const SourceAddress &source, const ParsedPacket &tile);
+
+    // Append the tiles collected since the last call to "tiles", in the
+    // order they arrived. Pixels stay valid until the next call to Add().
+    void TakeAll(std::vector<ParsedPacket> *tiles);
+
+    // Number of images replaced by a newer one before they were shown.
+    int64_t skipped() const { return skipped_; }
+
+private:
+    struct Place {
+        SourceAddress source;
+        int offset_x, offset_y, layer;
+        int width, height;
+
+        bool operator<(const Place &other) const;
+    };
+    struct Entry {
+        ParsedPacket tile;
+        bool superseded;
+        std::vector<char> data;
+    };
+
+    std::map<Place, int> index_;    // Where in entries_ the latest is.
+    std::deque<Entry> entries_;     // Kept between rounds to reuse buffers.
+    int count_;                     // Entries used in this round.
+    int64_t skipped_;
+};
+
+#endif  // FT_TILE_COALESCER_H
@@ -0,0 +1,46 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "triple-buffer.h"
+
+#include <strings.h>
+
+TripleBuffer::TripleBuffer(int width, int height)
+    : width_(width), height_(height), back_(0), front_(1), middle_(2) {
+    for (int i = 0; i < 3; ++i) {
+        buffers_[i] = new Color[width * height];
+        bzero(buffers_[i], width * height * sizeof(Color));
+    }
+}
+
+TripleBuffer::~TripleBuffer() {
+    for (int i = 0; i < 3; ++i) delete [] buffers_[i];
+}
+
+void TripleBuffer::Publish() {
+    // The release makes the frame content visible to the consumer, the
+    // acquire makes sure we see the consumer is done with what we get back.
+    const int previous = __atomic_exchange_n(&middle_, back_ | kNewFrame,
+                                             __ATOMIC_ACQ_REL);
+    back_ = previous & ~kNewFrame;
+}
+
+bool TripleBuffer::AcquireLatest() {
+    if ((__atomic_load_n(&middle_, __ATOMIC_RELAXED) & kNewFrame) == 0)
+        return false;
+    const int previous = __atomic_exchange_n(&middle_, front_,
+                                             __ATOMIC_ACQ_REL);
+    front_ = previous & ~kNewFrame;
+    return true;
+}
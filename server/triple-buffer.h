@@ -0,0 +1,64 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef FT_TRIPLE_BUFFER_H
+#define FT_TRIPLE_BUFFER_H
+
+#include "flaschen-taschen.h"
+
+// Lock-free exchange of whole frames between exactly one producer and one
+// consumer thread.
+//
+// The producer fills the back buffer and publishes it; the consumer picks up
+// the most recently published frame. Neither side ever waits for the other
+// and the consumer never sees a partially written frame. Frames published
+// while the consumer is busy are dropped in favor of newer ones.
+class TripleBuffer {
+public:
+    TripleBuffer(int width, int height);
+    ~TripleBuffer();
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // -- Producer side.
+
+    // The buffer to fill. Its content is undefined (an older frame).
+    Color *back() { return buffers_[back_]; }
+
+    // Make the back buffer the latest frame. back() returns a different
+    // buffer afterwards.
+    void Publish();
+
+    // -- Consumer side.
+
+    // If a new frame has been published since the last call, make it the
+    // front buffer and return true. Otherwise front() stays the same.
+    bool AcquireLatest();
+
+    // The frame acquired last.
+    const Color *front() const { return buffers_[front_]; }
+
+private:
+    enum { kNewFrame = 0x4 };   // Flag in middle_, above the buffer index.
+
+    const int width_;
+    const int height_;
+    Color *buffers_[3];
+    int back_;      // Only accessed by producer.
+    int front_;     // Only accessed by consumer.
+    int middle_;    // Exchanged atomically: buffer index | kNewFrame
+};
+
+#endif  // FT_TRIPLE_BUFFER_H
@@ -16,6 +16,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
@@ -24,49 +25,635 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <vector>
+
+#include "binary-protocol.h"
 #include "composite-flaschen-taschen.h"
+#include "event-loop.h"
+#include "frame-assembler.h"
 #include "ft-thread.h"
 #include "servers.h"
 #include "ppm-reader.h"
+#include "source-limiter.h"
+#include "tile-coalescer.h"
 
 volatile bool interrupt_received = false;
 static void InterruptHandler(int signo) {
   interrupt_received = true;
 }
 
-// public interface
-static int server_socket = -1;
-bool udp_server_init(int port) {
-    if ((server_socket = socket(PF_INET6, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+static bool print_stats_requested = false;
+static void PrintStatsHandler(int signo) {
+  print_stats_requested = true;
+}
+
+// Images not shown because a newer one of the same place superseded them.
+static int64_t skipped_frames = 0;
+
+// Batches to drain at most when coalescing before updating the display.
+static const int kMaxCoalesceBatches = 16;
+
+static int OpenServerSocket(int port, bool reuse_port) {
+    int fd;
+    if ((fd = socket(PF_INET6, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
         perror("IPv6 enabled ? While reating listen socket");
-        return false;
+        return -1;
     }
     int opt = 0;   // Unset IPv6-only, in case it is set. Best effort.
-    setsockopt(server_socket, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt));
 
     opt = 1;
-    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuse_port &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("SO_REUSEPORT");
+        close(fd);
+        return -1;
+    }
 
     struct sockaddr_in6 addr = {0};
     addr.sin6_family = AF_INET6;
     addr.sin6_addr = in6addr_any;
     addr.sin6_port = htons(port);
-    if (bind(server_socket, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
         perror("bind");
-        return false;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// public interface
+// One socket per receiver thread; with more than one, the kernel shards
+// incoming datagrams between them by hashing the source address/port.
+static std::vector<int> server_sockets;
+bool udp_server_init(int port, const UDPServerOptions &options) {
+    const int receivers = std::max(1, options.receiver_threads);
+    for (int i = 0; i < receivers; ++i) {
+        const int fd = OpenServerSocket(port, receivers > 1);
+        if (fd < 0)
+            return false;
+        server_sockets.push_back(fd);
     }
 
-    fprintf(stderr, "UDP-server: ready to listen on %d\n", port);
+    if (receivers > 1) {
+        fprintf(stderr, "UDP-server: ready to listen on %d "
+                "(%d receiver threads)\n", port, receivers);
+    } else {
+        fprintf(stderr, "UDP-server: ready to listen on %d\n", port);
+    }
     return true;
 }
 
-void udp_server_run_blocking(CompositeFlaschenTaschen *display,
-                             ft::Mutex *mutex) {
+// Decode the part of a compressed image that falls on the display into
+// "decode_buffer", and change "info" to describe just that part. So however
+// large a small packet claims the image to be, it never takes more memory
+// than the display. Returns false if nothing could be decoded.
+static bool DecodeCompressed(const FlaschenTaschen *display, int format,
+                             const char *data, size_t size,
+                             ImageMetaInfo *info,
+                             std::vector<char> *decode_buffer) {
+    const int x0 = std::max(0, -info->offset_x);
+    const int y0 = std::max(0, -info->offset_y);
+    const int x1 = std::min(info->width, display->width() - info->offset_x);
+    const int y1 = std::min(info->height, display->height() - info->offset_y);
+    if (x0 >= x1 || y0 >= y1)
+        return false;
+    decode_buffer->resize(3 * (x1 - x0) * (y1 - y0));
+    uint8_t *const rgb = (uint8_t*) &(*decode_buffer)[0];
+    int rows = 0;
+    switch (format) {
+    case PIXEL_FORMAT_RLE:
+        rows = DecodeRLEWindow((const uint8_t*)data, size, info->width,
+                               x0, y0, x1, y1, rgb);
+        break;
+    case PIXEL_FORMAT_PALETTE:
+        rows = DecodePaletteWindow((const uint8_t*)data, size, info->width,
+                                   x0, y0, x1, y1, rgb);
+        break;
+    }
+    if (rows <= 0)
+        return false;
+    info->offset_x += x0;
+    info->offset_y += y0;
+    info->width = x1 - x0;
+    info->height = rows;
+    return true;
+}
+
+// Parse the image header of a datagram. Does not need the display lock.
+// Compressed images are decoded into "decode_buffer", which needs to stay
+// around as long as the result is used.
+static void ParsePacket(const FlaschenTaschen *display,
+                        const char *packet, size_t size,
+                        std::vector<char> *decode_buffer, ParsedPacket *out) {
+    ImageMetaInfo img_info = {0};
+    out->frame_id = 0;
+    out->tile_index = 0;
+    out->tile_count = 0;
+    out->delta = false;
+    BinaryPacketHeader header;
+    const int binary_header_size
+        = DecodeBinaryPacketHeader((const uint8_t*)packet, size, &header);
+    if (binary_header_size > 0) {
+        img_info.width = header.width;
+        img_info.height = header.height;
+        img_info.range = 255;
+        img_info.offset_x = header.offset_x;
+        img_info.offset_y = header.offset_y;
+        img_info.layer = header.layer;
+        out->pixels = packet + binary_header_size;
+        out->frame_id = header.frame_id;
+        out->tile_index = header.tile_index;
+        out->tile_count = header.tile_count;
+        out->delta = (header.flags & BINARY_FLAG_DELTA) != 0;
+        if (header.format != PIXEL_FORMAT_RGB) {
+            if (DecodeCompressed(display, header.format, out->pixels,
+                                 size - binary_header_size,
+                                 &img_info, decode_buffer)) {
+                out->pixels = &(*decode_buffer)[0];
+            } else {
+                // Unknown format, broken, or not on the display.
+                img_info.width = img_info.height = 0;
+            }
+            out->info = img_info;
+            return;
+        }
+    } else if (binary_header_size < 0) {
+        // Binary, but nothing we can decode: drop instead of showing garbage.
+        out->pixels = packet + size;
+    } else {
+        img_info.width = display->width();  // defaults.
+        img_info.height = display->height();
+        out->pixels = ReadImageData(packet, size, &img_info);
+    }
+
+    // Raw images without header might be shorter than the display.
+    const size_t available = packet + size - out->pixels;
+    if (img_info.width <= 0) {
+        img_info.height = 0;
+    } else if ((size_t)img_info.width * img_info.height * 3 > available) {
+        img_info.height = available / (3 * img_info.width);
+    }
+    out->info = img_info;
+}
+
+// Copy the image contained in one datagram into the display. Caller holds
+// the display lock.
+static void ApplyPacket(CompositeFlaschenTaschen *display,
+                        const ParsedPacket &packet) {
+    const ImageMetaInfo &img_info = packet.info;
+    display->SetLayer(img_info.layer);
+    display->Blit(img_info.offset_x, img_info.offset_y,
+                  img_info.width, img_info.height,
+                  (const uint8_t*) packet.pixels, 3 * img_info.width);
+    display->SetLayer(0);  // Back to sane default.
+}
+
+// Print statistics if asked to with SIGUSR1.
+static void MaybePrintStats(SourceLimiter *limiter) {
+    if (__atomic_exchange_n(&print_stats_requested, false, __ATOMIC_RELAXED)) {
+        limiter->PrintStats(stderr);
+        fprintf(stderr, "%lld superseded frames skipped.\n",
+                (long long)__atomic_load_n(&skipped_frames, __ATOMIC_RELAXED));
+    }
+}
+
+static int64_t MonotonicMillis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+namespace {
+// Receives datagrams in batches: blocks until at least one is available,
+// then takes everything else pending (optionally waiting a bit for more)
+// up to the configured batch size.
+class BatchReceiver {
+public:
     static const int kBufferSize = 65535;  // maximum UDP has to offer.
-    char *packet_buffer = new char[kBufferSize];
-    bzero(packet_buffer, kBufferSize);
+
+    BatchReceiver(int fd, int batch_size, int wait_ms)
+        : fd_(fd), batch_size_(batch_size), wait_ms_(wait_ms),
+          buffers_(new char[batch_size * kBufferSize]),
+          sizes_(new size_t[batch_size]),
+          addresses_(new struct sockaddr_in6[batch_size]),
+          sources_(new SourceAddress[batch_size]) {
+        bzero(buffers_, batch_size * kBufferSize);
+        bzero(addresses_, batch_size * sizeof(*addresses_));
+#ifdef __linux__
+        msgs_ = new struct mmsghdr[batch_size];
+        iovecs_ = new struct iovec[batch_size];
+        bzero(msgs_, batch_size * sizeof(*msgs_));
+        for (int i = 0; i < batch_size; ++i) {
+            iovecs_[i].iov_base = buffers_ + i * kBufferSize;
+            iovecs_[i].iov_len = kBufferSize;
+            msgs_[i].msg_hdr.msg_iov = &iovecs_[i];
+            msgs_[i].msg_hdr.msg_iovlen = 1;
+            msgs_[i].msg_hdr.msg_name = &addresses_[i];
+        }
+#endif
+    }
+
+    ~BatchReceiver() {
+#ifdef __linux__
+        delete [] msgs_;
+        delete [] iovecs_;
+#endif
+        delete [] sources_;
+        delete [] addresses_;
+        delete [] sizes_;
+        delete [] buffers_;
+    }
+
+    // Receive next batch. Returns number of datagrams or -1 on error.
+    // If nothing arrives within "timeout_ms" (unless negative), returns 0.
+    // With a timeout of 0, only takes what is already pending.
+    int Receive(int timeout_ms) {
+        if (timeout_ms > 0) {
+            struct pollfd pfd = { fd_, POLLIN, 0 };
+            const int ready = poll(&pfd, 1, timeout_ms);
+            if (ready <= 0)
+                return ready;
+        }
+        int count = ReceiveAvailable(0, timeout_ms != 0);
+        if (count <= 0 || wait_ms_ <= 0)
+            return FinishBatch(count);
+        const int64_t deadline = MonotonicMillis() + wait_ms_;
+        while (count < batch_size_) {
+            const int64_t remaining = deadline - MonotonicMillis();
+            if (remaining <= 0)
+                break;
+            struct pollfd pfd = { fd_, POLLIN, 0 };
+            if (poll(&pfd, 1, remaining) <= 0)
+                break;
+            const int more = ReceiveAvailable(count, false);
+            if (more <= 0)
+                break;
+            count += more;
+        }
+        return FinishBatch(count);
+    }
+
+    const char *packet(int i) const { return buffers_ + i * kBufferSize; }
+    size_t size(int i) const { return sizes_[i]; }
+    const size_t *sizes() const { return sizes_; }
+    const SourceAddress *sources() const { return sources_; }
+
+private:
+    // Fill in the source addresses of the datagrams received.
+    int FinishBatch(int count) {
+        for (int i = 0; i < count; ++i) {
+            memcpy(sources_[i].address, &addresses_[i].sin6_addr,
+                   sizeof(sources_[i].address));
+            sources_[i].port = ntohs(addresses_[i].sin6_port);
+        }
+        return count;
+    }
+
+    // Receive into slots starting at "first". If "block", wait for the
+    // first datagram, otherwise only take what is already there.
+    int ReceiveAvailable(int first, bool block) {
+        const int slots = batch_size_ - first;
+#ifdef __linux__
+        for (int i = first; i < batch_size_; ++i)
+            msgs_[i].msg_hdr.msg_namelen = sizeof(addresses_[i]);
+        int r = recvmmsg(fd_, msgs_ + first, slots,
+                         block ? MSG_WAITFORONE : MSG_DONTWAIT, NULL);
+        if (r < 0)
+            return (!block && (errno == EAGAIN || errno == EWOULDBLOCK))
+                ? 0 : -1;
+        for (int i = 0; i < r; ++i)
+            sizes_[first + i] = msgs_[first + i].msg_len;
+        return r;
+#else
+        int count = 0;
+        while (count < slots) {
+            const int flags = (block && count == 0) ? 0 : MSG_DONTWAIT;
+            socklen_t address_len = sizeof(addresses_[first + count]);
+            ssize_t r = recvfrom(fd_, buffers_ + (first+count) * kBufferSize,
+                                 kBufferSize, flags,
+                                 (struct sockaddr*) &addresses_[first + count],
+                                 &address_len);
+            if (r < 0) {
+                if (count == 0 && (block || (errno != EAGAIN
+                                             && errno != EWOULDBLOCK)))
+                    return -1;
+                break;
+            }
+            sizes_[first + count] = r;
+            ++count;
+        }
+        return count;
+#endif
+    }
+
+    const int fd_;
+    const int batch_size_;
+    const int wait_ms_;
+    char *const buffers_;
+    size_t *const sizes_;
+    struct sockaddr_in6 *const addresses_;
+    SourceAddress *const sources_;
+#ifdef __linux__
+    struct mmsghdr *msgs_;
+    struct iovec *iovecs_;
+#endif
+};
+}  // namespace
+
+namespace {
+// Receives on one of the server sockets, either in the event loop or in a
+// thread of its own. Headers are parsed in the receiving thread, only the
+// compositing step is serialized on the mutex.
+class UDPReceiver : public ft::Thread, public EventHandler {
+public:
+    UDPReceiver(int fd, CompositeFlaschenTaschen *display, ft::Mutex *mutex,
+                SourceLimiter *limiter, const UDPServerOptions &options,
+                int batch_size)
+        : fd_(fd), display_(display), mutex_(mutex), limiter_(limiter),
+          batch_size_(batch_size),
+          receiver_(fd, batch_size, options.batch_wait_ms),
+          parsed_(new ParsedPacket[batch_size]),
+          decoded_(new std::vector<char>[batch_size]),
+          admitted_(new bool[batch_size]),
+          slot_(new int[batch_size]),
+          assembler_(options.frame_deadline_ms > 0
+                     ? new FrameAssembler(options.frame_deadline_ms,
+                                          options.coalesce)
+                     : NULL),
+          coalescer_(options.coalesce ? new TileCoalescer() : NULL),
+          reported_skipped_(0) {
+        bzero(count_, sizeof(count_));
+    }
+
+    virtual ~UDPReceiver() {
+        for (size_t i = 0; i < carried_.size(); ++i) delete carried_[i];
+        for (size_t i = 0; i < handled_.size(); ++i) delete handled_[i];
+        for (size_t i = 0; i < unused_.size(); ++i) delete unused_[i];
+        delete coalescer_;
+        delete assembler_;
+        delete [] slot_;
+        delete [] admitted_;
+        delete [] decoded_;
+        delete [] parsed_;
+    }
+
+    // Receive loop when running in a thread of its own.
+    virtual void Run() {
+        for (;;) {
+            const int timeout = TimeToNextDeadline(MonotonicMillis());
+            const int received_packets = receiver_.Receive(timeout);
+            if (interrupt_received)
+                break;
+            MaybePrintStats(limiter_);
+
+            if (received_packets < 0 && errno == EINTR) // Other signals.
+                continue;
+
+            if (received_packets < 0) {
+                perror("Trouble receiving.");
+                break;
+            }
+            if (!Process(received_packets, MonotonicMillis()))
+                continue;  // Only parts of frames so far.
+
+            mutex_->Lock();
+            Apply(display_);
+            display_->Send();
+            mutex_->Unlock();
+        }
+    }
+
+    // -- EventHandler, when served by the event loop.
+    virtual bool HandleReadable(int64_t now_ms) {
+        const int received_packets = receiver_.Receive(0);
+        if (received_packets < 0) {
+            if (errno != EINTR) perror("Trouble receiving.");
+            return false;
+        }
+        return Process(received_packets, now_ms);
+    }
+
+    virtual int TimeToNextDeadline(int64_t now_ms) const {
+        if (!carried_.empty())
+            return 0;   // Handle these right away.
+        return assembler_ ? assembler_->TimeToNextDeadline(now_ms) : -1;
+    }
+
+    virtual bool HandleTimeout(int64_t now_ms) {
+        return Process(0, now_ms);
+    }
+
+    virtual void Apply(CompositeFlaschenTaschen *display) {
+        for (size_t i = 0; i < ready_.size(); ++i) {
+            ApplyPacket(display, ready_[i]);
+        }
+    }
+
+    // Wake up a receiver blocked in Run() after interrupt_received is set.
+    void Wakeup() { shutdown(fd_, SHUT_RDWR); }
+
+private:
+    // Handle the "count" datagrams just received at "now" and collect the
+    // images that are ready to be shown in ready_. Returns false if there
+    // are none.
+    bool Process(int count, int64_t now) {
+        ready_.clear();
+        unused_.insert(unused_.end(), handled_.begin(), handled_.end());
+        handled_.clear();
+        HandleBatch(count, now, &ready_);
+        if (coalescer_) {
+            // Take whatever else is queued up; of images that replace
+            // each other, only the newest will be shown.
+            int last_batch = count;
+            for (int b = 1; b < kMaxCoalesceBatches; ++b) {
+                if (last_batch < batch_size_)
+                    break;   // Nothing more pending.
+                last_batch = receiver_.Receive(0);
+                if (last_batch <= 0)
+                    break;
+                now = MonotonicMillis();
+                HandleBatch(last_batch, now, &ready_);
+            }
+            coalescer_->TakeAll(&ready_);
+        }
+        if (assembler_) {
+            assembler_->TakeReady(now, &ready_);
+        }
+        if (coalescer_) {
+            const int64_t skipped = coalescer_->skipped()
+                + (assembler_ ? assembler_->skipped_frames() : 0);
+            __atomic_add_fetch(&skipped_frames, skipped - reported_skipped_,
+                               __ATOMIC_RELAXED);
+            reported_skipped_ = skipped;
+        }
+        return !ready_.empty();
+    }
+
+    // A datagram beyond the share of its source in a full batch, kept to be
+    // handled in the next round.
+    struct Carried {
+        SourceAddress source;
+        int slot;
+        std::vector<char> data;
+        std::vector<char> decoded;
+        ParsedPacket parsed;
+    };
+
+    // Admit and parse the "count" datagrams just received. Complete images
+    // are appended to "ready", unless they go to the assembler or
+    // coalescer first.
+    //
+    // If the batch is full, i.e. we are behind, each source only gets its
+    // share of the batch; the datagrams beyond it are carried over to the
+    // next round, before the ones received then. So a busy source can't
+    // push everyone else further behind, and eventually its datagrams are
+    // dropped.
+    void HandleBatch(int count, int64_t now, std::vector<ParsedPacket> *ready) {
+        limiter_->Admit(receiver_.sources(), receiver_.sizes(), count,
+                        now * 1000, admitted_, slot_);
+        const bool backlogged = (count == batch_size_ && count > 1);
+        const int share = backlogged ? FairShare(count) : batch_size_;
+
+        std::vector<Carried*> carried;
+        carried.swap(carried_);
+        for (size_t c = 0; c < carried.size(); ++c) {
+            Carried *const d = carried[c];
+            if (count_[d->slot] >= share) {
+                carried_.push_back(d);   // Still over its share.
+                continue;
+            }
+            ++count_[d->slot];
+            ParsePacket(display_, &d->data[0], d->data.size(),
+                        &d->decoded, &d->parsed);
+            Dispatch(d->source, d->parsed, now, ready);
+            handled_.push_back(d);
+        }
+
+        for (int i = 0; i < count; ++i) {
+            if (!admitted_[i])
+                continue;  // Over budget.
+            if (count_[slot_[i]] >= share) {
+                Carry(i);
+                continue;
+            }
+            ++count_[slot_[i]];
+            ParsedPacket *const packet = &parsed_[i];
+            ParsePacket(display_, receiver_.packet(i), receiver_.size(i),
+                        &decoded_[i], packet);
+            Dispatch(receiver_.sources()[i], *packet, now, ready);
+        }
+
+        for (size_t c = 0; c < carried_.size(); ++c)
+            count_[carried_[c]->slot] = 0;
+        for (size_t c = 0; c < handled_.size(); ++c)
+            count_[handled_[c]->slot] = 0;
+        for (int i = 0; i < count; ++i)
+            count_[slot_[i]] = 0;
+    }
+
+    // Number of datagrams each source may have handled in a full batch.
+    int FairShare(int count) {
+        int sources = 0;
+        for (size_t c = 0; c < carried_.size(); ++c) {
+            if (count_[carried_[c]->slot]++ == 0) ++sources;
+        }
+        for (int i = 0; i < count; ++i) {
+            if (admitted_[i] && count_[slot_[i]]++ == 0) ++sources;
+        }
+        for (size_t c = 0; c < carried_.size(); ++c)
+            count_[carried_[c]->slot] = 0;
+        for (int i = 0; i < count; ++i)
+            count_[slot_[i]] = 0;
+        return std::max(1, batch_size_ / std::max(1, sources));
+    }
+
+    // Keep datagram "i" for the next round, or drop it if we already keep
+    // a batch worth.
+    void Carry(int i) {
+        if ((int)carried_.size() >= batch_size_) {
+            limiter_->AddDropped(slot_[i]);
+            return;
+        }
+        Carried *d;
+        if (unused_.empty()) {
+            d = new Carried();
+        } else {
+            d = unused_.back();
+            unused_.pop_back();
+        }
+        d->source = receiver_.sources()[i];
+        d->slot = slot_[i];
+        d->data.assign(receiver_.packet(i), receiver_.packet(i)
+                       + receiver_.size(i));
+        carried_.push_back(d);
+    }
+
+    // Frames of a source that uses frame ids are applied in that order:
+    // one that fits in a datagram waits behind that source's frames still
+    // in the assembler, which only come out with TakeReady() at the end.
+    void Dispatch(const SourceAddress &source, const ParsedPacket &packet,
+                  int64_t now, std::vector<ParsedPacket> *ready) {
+        if (assembler_ && packet.tile_count > 1) {
+            assembler_->AddTile(source, packet, now);
+        } else if (assembler_ && packet.tile_count == 1
+                   && assembler_->AddFrame(source, packet, now)) {
+            // Queued or dropped.
+        } else if (coalescer_) {
+            coalescer_->Add(source, packet);
+        } else {
+            ready->push_back(packet);
+        }
+    }
+
+    const int fd_;
+    CompositeFlaschenTaschen *const display_;
+    ft::Mutex *const mutex_;
+    SourceLimiter *const limiter_;
+    const int batch_size_;
+    BatchReceiver receiver_;
+    ParsedPacket *const parsed_;
+    std::vector<char> *const decoded_; // Per datagram: pixels if compressed.
+    bool *const admitted_;             // Per datagram: within budget ?
+    int *const slot_;                  // Per datagram: source table slot.
+    int count_[SourceLimiter::kTableSize];   // Scratch: per source in batch.
+    FrameAssembler *const assembler_;  // NULL if tiles are shown right away.
+    TileCoalescer *const coalescer_;   // NULL if every image is shown.
+    int64_t reported_skipped_;
+    std::vector<ParsedPacket> ready_;  // To be applied to the display.
+    std::vector<Carried*> carried_;    // For the next round, oldest first.
+    std::vector<Carried*> handled_;    // Handled in this round.
+    std::vector<Carried*> unused_;
+};
+}  // namespace
+
+// Return the n-th CPU set in mask (round-robin), as affinity mask, or 0 if
+// no mask is given.
+static uint32_t NthCpuOfMask(uint32_t mask, int n) {
+    int cpu_count = 0;
+    for (int i = 0; i < 32; ++i)
+        if (mask & (1u << i)) ++cpu_count;
+    if (cpu_count == 0) return 0;
+    n %= cpu_count;
+    for (int i = 0; i < 32; ++i) {
+        if ((mask & (1u << i)) && n-- == 0)
+            return 1u << i;
+    }
+    return 0;
+}
+
+void udp_server_run_blocking(CompositeFlaschenTaschen *display,
+                             ft::Mutex *mutex,
+                             const UDPServerOptions &options,
+                             EventLoop *event_loop) {
+    int batch_size = options.batch_size;
+    if (batch_size < 1) batch_size = 1;
+    if (batch_size > 64) batch_size = 64;   // Don't hog too much memory.
 
     // Make sure the kernel keeps enough pending packets in case we have a
     // large display.
@@ -77,13 +664,16 @@ void udp_server_run_blocking(CompositeFlaschenTaschen *display,
     if (recv_size < kMinReceiveBuffer) {
       recv_size = kMinReceiveBuffer; // Small displays should have a minimum.
     }
-    if (setsockopt(server_socket, SOL_SOCKET, SO_RCVBUF, //
-                   &recv_size, sizeof(recv_size)) < 0) {
-      fprintf(stderr,
-              "Can not set a comfortable receive buffer size.\n"
-              "Consider setting at least\n"
-              "sudo sysctl -w net.core.rmem_max=%d\n",
-              recv_size);
+    for (size_t i = 0; i < server_sockets.size(); ++i) {
+        if (setsockopt(server_sockets[i], SOL_SOCKET, SO_RCVBUF, //
+                       &recv_size, sizeof(recv_size)) < 0) {
+            fprintf(stderr,
+                    "Can not set a comfortable receive buffer size.\n"
+                    "Consider setting at least\n"
+                    "sudo sysctl -w net.core.rmem_max=%d\n",
+                    recv_size);
+            break;
+        }
     }
 
     struct sigaction sa = {{0}};  // https://gcc.gnu.org/bugzilla/show_bug.cgi?id=53119
@@ -91,45 +681,58 @@ void udp_server_run_blocking(CompositeFlaschenTaschen *display,
     sigaction(SIGTERM, &sa, NULL);
     sigaction(SIGINT, &sa, NULL);
 
-    for (;;) {
-        // TODO: also store src-address in case we want to do rate-limiting
-        // per source-address.
-        ssize_t received_bytes = recvfrom(server_socket,
-                                          packet_buffer, kBufferSize,
-                                          0, NULL, 0);
-        if (interrupt_received)
-            break;
+    sa.sa_handler = PrintStatsHandler;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    SourceLimiter limiter(options.source_packets_per_second,
+                          options.source_bytes_per_second);
+    std::vector<UDPReceiver*> receivers;
+    for (size_t i = 0; i < server_sockets.size(); ++i) {
+        receivers.push_back(new UDPReceiver(server_sockets[i], display, mutex,
+                                            &limiter, options, batch_size));
+    }
 
-        if (received_bytes < 0 && errno == EINTR) // Other signals. Don't care.
-            continue;
+    // Additional receivers run in their own threads. They should not see
+    // the termination or statistics signals, these are handled by the
+    // calling thread.
+    sigset_t block_set, old_set;
+    sigemptyset(&block_set);
+    sigaddset(&block_set, SIGTERM);
+    sigaddset(&block_set, SIGINT);
+    sigaddset(&block_set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &block_set, &old_set);
+    for (size_t i = 1; i < receivers.size(); ++i) {
+        receivers[i]->Start(0, NthCpuOfMask(options.receiver_cpu_mask, i));
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
 
-        if (received_bytes < 0) {
-            perror("Trouble receiving.");
+    // The first one is served by the event loop in this thread, together
+    // with the other front-ends.
+    if (!event_loop->Add(server_sockets[0], receivers[0])) {
+        receivers[0] = NULL;  // Deleted already.
+        interrupt_received = true;
+    }
+    while (!interrupt_received) {
+        if (!event_loop->RunOnce()) {
+            perror("Event loop");
             break;
         }
+        MaybePrintStats(&limiter);
+    }
 
-        ImageMetaInfo img_info = {0};
-        img_info.width = display->width();  // defaults.
-        img_info.height = display->height();
-
-        const char *pixel_pos = ReadImageData(packet_buffer, received_bytes,
-                                              &img_info);
-        mutex->Lock();
-        display->SetLayer(img_info.layer);
-        for (int y = 0; y < img_info.height; ++y) {
-            for (int x = 0; x < img_info.width; ++x) {
-                Color c;
-                c.r = *pixel_pos++;
-                c.g = *pixel_pos++;
-                c.b = *pixel_pos++;
-                display->SetPixel(x + img_info.offset_x,
-                                  y + img_info.offset_y,
-                                  c);
-            }
-        }
-        display->Send();
-        display->SetLayer(0);  // Back to sane default.
-        mutex->Unlock();
+    interrupt_received = true;
+    for (size_t i = 1; i < receivers.size(); ++i) {
+        receivers[i]->Wakeup();
+        receivers[i]->WaitStopped();
+    }
+    for (size_t i = 1; i < receivers.size(); ++i) {
+        delete receivers[i];
+    }
+    if (receivers[0]) {
+        event_loop->Remove(receivers[0]);   // Owned by the loop.
+    }
+    if (options.coalesce) {
+        fprintf(stderr, "UDP-server: %lld superseded frames skipped.\n",
+                (long long)skipped_frames);
     }
-    delete [] packet_buffer;
 }